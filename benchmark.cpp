@@ -0,0 +1,302 @@
+//benchmarks of the DNA4Set operations, building and searching the OffTargetFinder index, the simple method and the istream scan
+//every workload is generated from a fixed seed so the results of two releases can be compared, and they are written as json
+//build with: g++ -std=c++17 -O3 -march=native -pthread benchmark.cpp -o benchmark
+//usage: benchmark [--quick] [--seed n] [--threads n] [--out results.json] [--trace trace.json]
+//the results are written to benchmark.json by default, --trace also writes the phases of the run as a chrome trace
+//each parameter is swept on its own with the others at the baseline, --quick uses smaller workloads
+//the latency percentiles are of blocks of 2^14 windows, for index_build the windows are the targets indexed
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <sys/resource.h>
+#include "fuzzyMatch.h"
+
+//the parameters of one workload
+struct Workload
+{
+	size_t numTargets;
+	size_t seqLength;
+	uint32_t targetLength;
+	uint32_t mismatches;
+	std::string filter;
+};
+
+bool operator==(const Workload &a, const Workload &b)
+{
+	return a.numTargets==b.numTargets && a.seqLength==b.seqLength && a.targetLength==b.targetLength && a.mismatches==b.mismatches && a.filter==b.filter;
+}
+
+//the measurements of one benchmark of one workload
+struct Result
+{
+	std::string benchmark;
+	Workload workload;
+	//the sequence windows scanned, or the targets indexed by index_build
+	uint64_t windows;
+	//the target comparisons made, zero when they are not known
+	uint64_t comparisons;
+	double seconds;
+	//the time of each block of the workload, sorted
+	std::vector<double> blockMicroseconds;
+	uint64_t peakRSS;
+};
+
+//the peak resident set size is reset before each benchmark where the kernel allows it, otherwise it is the peak of the whole run
+void resetPeakRSS()
+{
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5";
+}
+
+//bytes
+uint64_t peakRSS()
+{
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while(std::getline(status,line))
+	{
+		if(line.compare(0,6,"VmHWM:")==0)
+			return std::stoull(line.substr(6))*1024;
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF,&usage);
+	return uint64_t(usage.ru_maxrss)*1024;
+}
+
+std::string randomSequence(size_t length, std::mt19937_64 &random)
+{
+	constexpr char DNA[4] = {'A','C','G','T'};
+	std::string sequence(length,'A');
+	for(size_t i = 0; i < length; ++i)
+	{
+		sequence[i] = DNA[random() & 3];
+	}
+	return sequence;
+}
+
+//the targets always have the fixed characters of the filter, as the targets of a real search would
+std::vector<std::string> randomTargets(const Workload &w, std::mt19937_64 &random)
+{
+	std::vector<std::string> targets(w.numTargets);
+	for(std::string &target : targets)
+	{
+		target = randomSequence(w.targetLength,random);
+		size_t offset = w.targetLength-w.filter.size();
+		for(size_t j = 0; j < w.filter.size(); ++j)
+		{
+			char c = w.filter[j];
+			if(c=='A' || c=='C' || c=='G' || c=='T')
+				target[offset+j] = c;
+		}
+	}
+	return targets;
+}
+
+//times work(begin,end) on each block of blockSize windows of numWindows windows
+template<class Work>
+void timeBlocks(size_t numWindows, size_t blockSize, Result &result, Work &&work)
+{
+	resetPeakRSS();
+	auto start = std::chrono::steady_clock::now();
+	for(size_t begin = 0; begin < numWindows; begin += blockSize)
+	{
+		auto blockStart = std::chrono::steady_clock::now();
+		work(begin,std::min(begin+blockSize,numWindows));
+		result.blockMicroseconds.push_back(std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now()-blockStart).count());
+	}
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	result.peakRSS = peakRSS();
+	result.windows = numWindows;
+	std::sort(result.blockMicroseconds.begin(),result.blockMicroseconds.end());
+}
+
+struct CountTargets
+{
+	uint64_t count = 0;
+	void doAction(DNA4 &,uint32_t,Strand = Strand::forward){count++;}
+};
+
+std::vector<Result> runWorkload(const Workload &w, uint64_t seed, uint32_t numThreads, uint64_t maxSimpleComparisons)
+{
+	DNA4::setLength(w.targetLength);
+	Filter filter(w.filter);
+	std::mt19937_64 random(seed);
+	const std::string sequence = randomSequence(w.seqLength,random);
+	const std::vector<DNA4> targets = stringsToDNA4(randomTargets(w,random));
+	const size_t numWindows = w.seqLength-w.targetLength+1;
+	const size_t blockSize = 1<<14;
+	//the results are filled in through references returned by newResult, so the vector must not reallocate
+	std::vector<Result> results;
+	results.reserve(8);
+	auto newResult = [&](const std::string &benchmark) -> Result&
+	{
+		results.push_back(Result{benchmark,w,0,0,0,{},0});
+		return results.back();
+	};
+
+	//the windows that pass the filter are the ones compared with the targets
+	CountTargets passing;
+	doForTargetsInSequence(sequence,filter,passing);
+
+	DNA4Set set(filter);
+	DNA4Set found(filter);
+	timeBlocks(numWindows,blockSize,newResult("dna4set_insert"),[&](size_t begin, size_t end)
+	{
+		doForTargetsInSequence(sequence.data(),begin,end,filter,AddToSet<DNA4Set>(set));
+	});
+	timeBlocks(numWindows,blockSize,newResult("dna4set_contains"),[&](size_t begin, size_t end)
+	{
+		doForTargetsInSequence(sequence.data(),begin,end,filter,AddToSetIfExistingInOtherSet<DNA4Set,DNA4Set>(found,set));
+	});
+	timeBlocks(numWindows,blockSize,newResult("dna4set_remove"),[&](size_t begin, size_t end)
+	{
+		doForTargetsInSequence(sequence.data(),begin,end,filter,RemoveFromSet<DNA4Set>(set));
+	});
+
+	//the count is checked so the scan is not optimised away
+	uint64_t streamed = 0;
+	timeBlocks(numWindows,blockSize,newResult("istream_scan"),[&](size_t begin, size_t end)
+	{
+		std::istringstream stream(sequence.substr(begin,end-begin+w.targetLength-1));
+		CountTargets count;
+		doForTargetsInSequence(stream,filter,count);
+		streamed += count.count;
+	});
+	if(streamed!=passing.count)
+	{
+		std::cout << "ERROR: the stream scan found " << streamed << " targets, not " << passing.count << std::endl;
+	}
+
+	//the finders count the off targets so the memory of the results does not grow with the workload
+	Result &build = newResult("index_build");
+	resetPeakRSS();
+	auto start = std::chrono::steady_clock::now();
+	OffTargetFinder indexFinder(targets,w.mismatches,filter,~0ULL,true,numThreads);
+	build.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	build.blockMicroseconds.push_back(build.seconds*1e6);
+	build.peakRSS = peakRSS();
+	build.windows = targets.size();
+
+	timeBlocks(numWindows,blockSize,newResult("index_query"),[&](size_t begin, size_t end)
+	{
+		doForTargetsInSequence(sequence.data(),begin,end,filter,FindIfOffTargetInBatches(indexFinder,0));
+	});
+
+	//the simple method only searches as much of the sequence as keeps it to maxSimpleComparisons comparisons
+	OffTargetFinder simpleFinder(targets,w.mismatches,filter,~0ULL,true,numThreads,0);
+	double passingFraction = double(passing.count)/numWindows;
+	size_t simpleWindows = std::min<size_t>(numWindows,std::max(1.0,maxSimpleComparisons/(targets.size()*std::max(passingFraction,1e-9))));
+	CountTargets simplePassing;
+	doForTargetsInSequence(sequence.data(),0,simpleWindows,filter,simplePassing);
+	Result &simple = newResult("simple_query");
+	timeBlocks(simpleWindows,std::min(blockSize,simpleWindows/16+1),simple,[&](size_t begin, size_t end)
+	{
+		doForTargetsInSequence(sequence.data(),begin,end,filter,FindIfOffTarget(simpleFinder,0));
+	});
+	simple.comparisons = simplePassing.count*targets.size();
+	return results;
+}
+
+double percentile(const std::vector<double> &sorted, double p)
+{
+	if(sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size()-1,size_t(p*sorted.size()))];
+}
+
+void writeJSON(std::ostream &out, const std::vector<Result> &results, uint64_t seed, uint32_t numThreads, bool quick)
+{
+	out << "{\n\t\"seed\": " << seed << ",\n\t\"threads\": " << numThreads << ",\n\t\"quick\": " << (quick ? "true" : "false") << ",\n";
+	out << "\t\"compiler\": \"" << __VERSION__ << "\",\n\t\"results\": [";
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		const Result &r = results[i];
+		const Workload &w = r.workload;
+		out << (i ? ",\n" : "\n") << "\t\t{\"benchmark\": \"" << r.benchmark << "\", \"targets\": " << w.numTargets << ", \"sequence_length\": " << w.seqLength
+			<< ", \"target_length\": " << w.targetLength << ", \"mismatches\": " << w.mismatches << ", \"filter\": \"" << w.filter << "\""
+			<< ", \"windows\": " << r.windows << ", \"seconds\": " << r.seconds << ", \"windows_per_second\": " << r.windows/r.seconds
+			<< ", \"comparisons_per_second\": ";
+		if(r.comparisons)
+			out << r.comparisons/r.seconds;
+		else
+			out << "null";
+		out << ", \"block_latency_us\": {\"p50\": " << percentile(r.blockMicroseconds,0.5) << ", \"p90\": " << percentile(r.blockMicroseconds,0.9)
+			<< ", \"p99\": " << percentile(r.blockMicroseconds,0.99) << ", \"max\": " << percentile(r.blockMicroseconds,1) << "}"
+			<< ", \"peak_rss_bytes\": " << r.peakRSS << "}";
+	}
+	out << "\n\t]\n}" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	bool quick = false;
+	uint64_t seed = 1;
+	uint32_t numThreads = 1;
+	std::string outPath = "benchmark.json";
+	std::string tracePath;
+	for(int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if(arg=="--quick")
+			quick = true;
+		else if(arg=="--seed" && i+1 < argc)
+			seed = std::stoull(argv[++i]);
+		else if(arg=="--threads" && i+1 < argc)
+			numThreads = std::stoul(argv[++i]);
+		else if(arg=="--out" && i+1 < argc)
+			outPath = argv[++i];
+		else if(arg=="--trace" && i+1 < argc)
+			tracePath = argv[++i];
+		else
+		{
+			std::cout << "usage: " << argv[0] << " [--quick] [--seed n] [--threads n] [--out results.json] [--trace trace.json]" << std::endl;
+			return 1;
+		}
+	}
+
+	const Workload baseline = quick ? Workload{20000,200000,23,4,"xxxxxxxxxxxxxxxxxxxxNGG"} : Workload{200000,1000000,23,4,"xxxxxxxxxxxxxxxxxxxxNGG"};
+	const uint64_t maxSimpleComparisons = quick ? 1ULL << 30 : 1ULL << 34;
+	std::vector<Workload> workloads{baseline};
+	auto sweep = [&](auto values, auto set)
+	{
+		for(auto value : values)
+		{
+			Workload w = baseline;
+			set(w,value);
+			if(std::find(workloads.begin(),workloads.end(),w)==workloads.end())
+				workloads.push_back(w);
+		}
+	};
+	sweep(std::vector<size_t>{baseline.numTargets/10,baseline.numTargets*5},[](Workload &w, size_t v){w.numTargets = v;});
+	sweep(std::vector<size_t>{baseline.seqLength/4,baseline.seqLength*4},[](Workload &w, size_t v){w.seqLength = v;});
+	sweep(std::vector<uint32_t>{20,28},[](Workload &w, uint32_t v){w.targetLength = v; w.filter = std::string(v-3,'x')+"NGG";});
+	sweep(std::vector<uint32_t>{2,3,5},[](Workload &w, uint32_t v){w.mismatches = v;});
+	sweep(std::vector<std::string>{"","x*XXXXXXX*XXXXXXXXXXGXG"},[](Workload &w, const std::string &v){w.filter = v;});
+
+	if(tracePath.size())
+		Tracer::instance().enable();
+	std::vector<Result> results;
+	for(const Workload &w : workloads)
+	{
+		std::cerr << "targets " << w.numTargets << " sequence " << w.seqLength << " length " << w.targetLength
+			<< " mismatches " << w.mismatches << " filter \'" << w.filter << "\'" << std::endl;
+		for(const Result &r : runWorkload(w,seed,numThreads,maxSimpleComparisons))
+		{
+			std::cerr << "\t" << r.benchmark << "\t" << r.seconds << "s" << std::endl;
+			results.push_back(r);
+		}
+	}
+
+	std::ofstream out(outPath);
+	if(!out)
+	{
+		std::cout << "ERROR: could not create results file \'" << outPath << "\'" << std::endl;
+		return 1;
+	}
+	writeJSON(out,results,seed,numThreads,quick);
+	if(tracePath.size() && !Tracer::instance().writeChromeTrace(tracePath))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include "mappedFile.h"
+#include "fuzzyMatch.h"
+
+//a read only memory mapped fasta file
+//the sequences are scanned straight from the mapped file without being copied
+class FastaFile
+{
+	public:
+	struct Record
+	{
+		//the header line without the '>'
+		std::string name;
+		//the sequence, including its line breaks, is from begin to end-1
+		const char *begin;
+		const char *end;
+	};
+
+	FastaFile(const std::string &path)
+	:file(path)
+	{
+		if(file.isOpen())
+		{
+			file.adviseSequential();
+			findRecords();
+		}
+	}
+
+	FastaFile(const FastaFile&) = delete;
+	FastaFile& operator=(const FastaFile&) = delete;
+
+	bool isOpen() const {return file.isOpen();}
+
+	size_t size() const {return records.size();}
+
+	const Record &operator[](size_t i) const {return records[i];}
+
+	std::vector<Record>::const_iterator begin() const {return records.begin();}
+	std::vector<Record>::const_iterator end() const {return records.end();}
+
+	private:
+	//a record starts with a '>' at the start of a line, anything before the first record is treated as a record with no name
+	void findRecords()
+	{
+		const char *data = file.begin();
+		const char *fileEnd = file.end();
+		const char *c = data;
+		if(*c!='>')
+		{
+			c = nextRecord(c,fileEnd);
+			if(c>data)
+			{
+				records.push_back(Record{std::string(),data,c});
+			}
+		}
+		while(c < fileEnd)
+		{
+			const char *headerEnd = static_cast<const char*>(memchr(c,'\n',fileEnd-c));
+			const char *sequenceBegin = headerEnd ? headerEnd+1 : fileEnd;
+			if(headerEnd==nullptr)
+				headerEnd = fileEnd;
+			if(headerEnd>c+1 && headerEnd[-1]=='\r')
+				headerEnd--;
+			const char *sequenceEnd = nextRecord(sequenceBegin,fileEnd);
+			records.push_back(Record{std::string(c+1,headerEnd),sequenceBegin,sequenceEnd});
+			c = sequenceEnd;
+		}
+	}
+
+	//returns the first '>' at the start of a line from c, or end if there isn't one
+	static const char *nextRecord(const char *c, const char *end)
+	{
+		while(c < end)
+		{
+			const char *header = static_cast<const char*>(memchr(c,'>',end-c));
+			if(header==nullptr)
+				return end;
+			if(header==c || header[-1]=='\n')
+				return header;
+			c = header+1;
+		}
+		return end;
+	}
+
+	MappedFile file;
+	std::vector<Record> records;
+};
+
+template<class Action>
+void doForTargetsInSequence(const FastaFile::Record &record, Filter filter, Action &&action)
+{
+	doForTargetsInLines(record.begin,record.end,record.end,0,filter,action);
+}
+
+template<class Action>
+void doForTargetsOnBothStrands(const FastaFile::Record &record, Filter filter, Action &&action)
+{
+	doForTargetsInLines(record.begin,record.end,record.end,0,filter,action,true);
+}
+
+//a part of a record that starts at the beginning of a line
+struct FastaChunk
+{
+	uint32_t record;
+	const char *begin;
+	const char *end;
+	//the position in the record of the first sequence character of the chunk
+	size_t firstPosition;
+};
+
+//splits the records of fasta into chunks of about chunkSize bytes, using numThreads threads to count the characters before each chunk
+std::vector<FastaChunk> splitIntoChunks(const FastaFile &fasta, size_t chunkSize, uint32_t numThreads)
+{
+	//split the records into chunks that start at the beginning of a line
+	std::vector<FastaChunk> chunks;
+	for(uint32_t r = 0; r < fasta.size(); ++r)
+	{
+		const FastaFile::Record &record = fasta[r];
+		for(const char *begin = record.begin; begin < record.end;)
+		{
+			const char *end = record.end;
+			if(size_t(record.end-begin) > chunkSize)
+			{
+				end = static_cast<const char*>(memchr(begin+chunkSize,'\n',record.end-begin-chunkSize));
+				end = end ? end+1 : record.end;
+			}
+			chunks.push_back(FastaChunk{r,begin,end,0});
+			begin = end;
+		}
+	}
+	//the position of each chunk is the number of sequence characters in the chunks before it in its record
+	runInParallel(chunks.size(),numThreads,[&](size_t chunk, uint32_t)
+	{
+		chunks[chunk].firstPosition = numberOfSequenceCharacters(chunks[chunk].begin,chunks[chunk].end);
+	});
+	size_t position = 0;
+	for(size_t i = 0; i < chunks.size(); ++i)
+	{
+		if(i>0 && chunks[i].record!=chunks[i-1].record)
+			position = 0;
+		size_t numCharacters = chunks[i].firstPosition;
+		chunks[i].firstPosition = position;
+		position += numCharacters;
+	}
+	return chunks;
+}
+
+//multithreaded search of every record of fasta using numThreads threads (0 uses all available cores)
+//the off targets in record i get the seqID action.sequenceID+i, records are split into chunks of about chunkSize bytes
+void findOffTargetsInFasta(const FastaFile &fasta, Filter filter, FindIfOffTarget &action, uint32_t numThreads, bool bothStrands, size_t chunkSize = OffTargetFinder::defaultChunkSize)
+{
+	std::vector<FastaChunk> chunks = splitIntoChunks(fasta,chunkSize,numThreads);
+	action.offTargetFinder.findMatchesInChunks(chunks.size(),numThreads,[&](size_t chunk, auto &chunkAction)
+	{
+		const FastaChunk &c = chunks[chunk];
+		chunkAction.sequenceID = action.sequenceID+c.record;
+		doForTargetsInLines(c.begin,c.end,fasta[c.record].end,c.firstPosition,filter,chunkAction,bothStrands);
+	});
+}
+
+void doForTargetsInSequence(const FastaFile &fasta, Filter filter, FindIfOffTarget &&action, uint32_t numThreads)
+{
+	findOffTargetsInFasta(fasta,filter,action,numThreads,false);
+}
+
+void doForTargetsOnBothStrands(const FastaFile &fasta, Filter filter, FindIfOffTarget &&action, uint32_t numThreads)
+{
+	findOffTargetsInFasta(fasta,filter,action,numThreads,true);
+}
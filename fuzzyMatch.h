@@ -10,7 +10,18 @@
 #include <iterator>
 #include <algorithm>
 #include <bitset>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
 #include "stopwatch.h"
+#include "tracer.h"
+#include "mappedFile.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 constexpr uint64_t acs[256] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
 								0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
@@ -29,9 +40,60 @@ constexpr uint64_t gts[256] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+enum class Strand : uint8_t {forward, reverse};
+
+//true for A, C, G and T in either case, every other character, such as N or another IUPAC code, is stored as no base
+bool isBase(unsigned char c)
+{
+	return acs[c] | gts[c];
+}
+
+uint32_t reverseBits(uint32_t x)
+{
+	x = (x >> 1 & 0x55555555) | (x & 0x55555555) << 1;
+	x = (x >> 2 & 0x33333333) | (x & 0x33333333) << 2;
+	x = (x >> 4 & 0x0F0F0F0F) | (x & 0x0F0F0F0F) << 4;
+	return __builtin_bswap32(x);
+}
+
+//moves bit i of x to bit 2i
+uint64_t spreadBits(uint32_t x)
+{
+#if defined(__BMI2__)
+	return _pdep_u64(x,0x5555555555555555ULL);
+#else
+	uint64_t y = x;
+	y = (y | y << 16) & 0x0000FFFF0000FFFFULL;
+	y = (y | y << 8) & 0x00FF00FF00FF00FFULL;
+	y = (y | y << 4) & 0x0F0F0F0F0F0F0F0FULL;
+	y = (y | y << 2) & 0x3333333333333333ULL;
+	y = (y | y << 1) & 0x5555555555555555ULL;
+	return y;
+#endif
+}
+
+//packs the bits of x in the positions set in mask into the low bits of the result, keeping their order
+uint64_t gatherBits(uint64_t x, uint64_t mask)
+{
+#if defined(__BMI2__)
+	return _pext_u64(x,mask);
+#else
+	uint64_t result = 0;
+	for(uint64_t bit = 1; mask; bit <<= 1)
+	{
+		if(x & mask & -mask)
+			result |= bit;
+		mask &= mask-1;
+	}
+	return result;
+#endif
+}
+
 //represents up to a length 32 strand of DNA
 struct DNA4{
 
+	//each thread has its own target length, so threads can search for targets of different lengths at the same time
+	//the threads started by runInParallel take the length of the thread that starts them
 	static void setLength(uint32_t length)
 	{
 		DNA4::length = length;
@@ -41,6 +103,17 @@ struct DNA4{
 	}
 
 	static uint32_t getLength(){return length;}
+
+	//the members that take a Length template argument treat it as the length when it isn't 0, so the masks and shifts
+	//that depend on the length become constants, it must then be the length set with setLength, except that addCharacter
+	//and addReverseComplementCharacter can keep windows of Length characters for any length
+	template<uint32_t Length>
+	static uint32_t lengthOf(){return Length ? Length : length;}
+	template<uint32_t Length>
+	static uint64_t fullMaskOf(){return Length ? fullMaskOf(Length) : fullMask;}
+	//the mask of the characters of a target of length length, in both halves
+	static uint64_t fullMaskOf(uint32_t length){return ((1ULL<<length)-1)*((1ULL<<32)+1);}
+
 	uint64_t ACandGT[2];
 
 	DNA4(const char *s)
@@ -92,6 +165,22 @@ struct DNA4{
 	:DNA4(s.data())
 	{}
 
+	//the same as DNA4(s)
+	template<uint32_t Length>
+	static DNA4 fromCharacters(const char *s)
+	{
+		if(!Length)
+			return DNA4(s);
+		DNA4 d;
+		for(uint32_t i = 0; i < Length; ++i)
+		{
+			unsigned char c = s[i];
+			d.ACandGT[0] = d.ACandGT[0] << 1 | acs[c];
+			d.ACandGT[1] = d.ACandGT[1] << 1 | gts[c];
+		}
+		return d;
+	}
+
 	DNA4()
 	:ACandGT{0,0}
 	{}
@@ -137,17 +226,38 @@ struct DNA4{
 		ACandGT[1] &= mask;		
 	}
 
+	template<uint32_t Length = 0>
 	bool addCharacter(unsigned char c)
 	{
 		ACandGT[0] <<= 1;
 		ACandGT[1] <<= 1;
-		uint64_t mask = (~(1ULL|(1ULL<<32)))&DNA4::fullMask;
+		uint64_t mask = (~(1ULL|(1ULL<<32)))&fullMaskOf<Length>();
 		ACandGT[0] &= mask;
 		ACandGT[1] &= mask;
 		ACandGT[0] |= acs[c];
 		ACandGT[1] |= gts[c];
 		return c;
 	}
+	//the reverse complement equivalent of addCharacter
+	//if this is the reverse complement of a sequence then it stays the reverse complement when c is added to that sequence
+	template<uint32_t Length = 0>
+	void addReverseComplementCharacter(unsigned char c)
+	{
+		//the bit in position 31 would otherwise be the last character of the high half
+		ACandGT[0] = (ACandGT[0] >> 1) & ~(1ULL << 31);
+		ACandGT[1] = (ACandGT[1] >> 1) & ~(1ULL << 31);
+		//the complement of a character is in the other word with its high and low halves swapped
+		//eg A is in the high half of ACandGT[0] and T is in the low half of ACandGT[1]
+		ACandGT[0] |= (gts[c] << 32 | gts[c] >> 32) << (lengthOf<Length>()-1);
+		ACandGT[1] |= (acs[c] << 32 | acs[c] >> 32) << (lengthOf<Length>()-1);
+	}
+	DNA4 reverseComplement() const
+	{
+		DNA4 rc;
+		rc[0] = uint64_t(reverseCharacters(Ts())) << 32 | reverseCharacters(Gs());
+		rc[1] = uint64_t(reverseCharacters(Cs())) << 32 | reverseCharacters(As());
+		return rc;
+	}
 	void addWildcards(const char *s)
 	{
 		uint64_t ACs = 0;
@@ -241,6 +351,15 @@ struct DNA4{
 	{
 		return __builtin_popcountll ((ACandGT[0]&b[0])|(ACandGT[1]&b[1]));
 	}
+	//packs each character into two bits, the first is set for A or C and the second for G or C, so T is 00
+	//the positions are reversed so the first character is in the two most significant bits
+	//only A, C, G and T are packed exactly, any other character is packed by the same rule so it looks like one of them
+	uint64_t toTwoBits() const
+	{
+		uint32_t first = uint32_t(ACandGT[0]>>32) | uint32_t(ACandGT[0]);
+		uint32_t second = uint32_t(ACandGT[1]>>32) | uint32_t(ACandGT[0]);
+		return spreadBits(reverseBits(first)) | spreadBits(reverseBits(second)) << 1;
+	}
 	std::string toString() const
 	{
 		std::string s(DNA4::length,'N');
@@ -266,22 +385,182 @@ struct DNA4{
 		return s;
 	}
 	private:
-	static uint_fast8_t length;
-	static uint64_t lowLengthMask;
-	static uint64_t highLengthMask;
-	static uint64_t fullMask;
+	//reverses the order of the first length bits
+	static uint32_t reverseCharacters(uint32_t x)
+	{
+		return uint64_t(reverseBits(x)) >> (32-length);
+	}
+	static thread_local uint_fast8_t length;
+	static thread_local uint64_t lowLengthMask;
+	static thread_local uint64_t highLengthMask;
+	static thread_local uint64_t fullMask;
+};
+
+thread_local uint64_t DNA4::highLengthMask = ~0ULL;
+thread_local uint64_t DNA4::lowLengthMask = ~0ULL;
+thread_local uint64_t DNA4::fullMask = ~0ULL;
+thread_local uint_fast8_t DNA4::length = 0;
+
+//define FUZZY_MATCH_STATS before including this to count what the scans and searches do, see searchStats
+//without it COUNT_SEARCH_STATS compiles to nothing, so the counting costs nothing
+#ifdef FUZZY_MATCH_STATS
+#define COUNT_SEARCH_STATS(counting) do{SearchStats &stats = threadSearchStats(); counting;}while(0)
+#else
+#define COUNT_SEARCH_STATS(counting) do{}while(0)
+#endif
+
+#ifdef FUZZY_MATCH_STATS
+//the counts of what the scans and searches did, each thread counts into its own and searchStats adds them up
+struct SearchStats
+{
+	//windows read by the scans, a window on each strand when both strands are scanned
+	uint64_t windowsScanned = 0;
+	uint64_t windowsPassingFilter = 0;
+	//sequences searched for with the index and with the simple method
+	uint64_t indexSearches = 0;
+	uint64_t simpleSearches = 0;
+	//one for each hashmap probed for each sequence searched for with the index
+	uint64_t bucketsProbed = 0;
+	//targets compared with a sequence, every target for the simple method
+	uint64_t candidatesVerified = 0;
+	//targets within the mismatches that were not kept because an earlier hashmap had already found them
+	uint64_t duplicatesSuppressed = 0;
+	std::array<uint64_t,33> hitsAtDistance{};
+
+	void add(const SearchStats &o)
+	{
+		windowsScanned += o.windowsScanned;
+		windowsPassingFilter += o.windowsPassingFilter;
+		indexSearches += o.indexSearches;
+		simpleSearches += o.simpleSearches;
+		bucketsProbed += o.bucketsProbed;
+		candidatesVerified += o.candidatesVerified;
+		duplicatesSuppressed += o.duplicatesSuppressed;
+		for(size_t d = 0; d < hitsAtDistance.size(); ++d)
+		{
+			hitsAtDistance[d] += o.hitsAtDistance[d];
+		}
+	}
+
+	//the hits are written up to the largest distance that has any
+	void writeJSON(std::ostream &out) const
+	{
+		out << "{\"windows_scanned\": " << windowsScanned << ", \"windows_passing_filter\": " << windowsPassingFilter
+			<< ", \"index_searches\": " << indexSearches << ", \"simple_searches\": " << simpleSearches
+			<< ", \"buckets_probed\": " << bucketsProbed << ", \"candidates_verified\": " << candidatesVerified
+			<< ", \"duplicates_suppressed\": " << duplicatesSuppressed << ", \"hits_at_distance\": [";
+		size_t distances = hitsAtDistance.size();
+		while(distances > 0 && hitsAtDistance[distances-1]==0)
+			distances--;
+		for(size_t d = 0; d < distances; ++d)
+		{
+			out << (d ? ", " : "") << hitsAtDistance[d];
+		}
+		out << "]}";
+	}
+};
+
+//keeps track of the counts of every thread, the counts of a thread that has finished are added to retired
+class SearchStatsRegistry
+{
+	public:
+	static SearchStatsRegistry &instance()
+	{
+		static SearchStatsRegistry registry;
+		return registry;
+	}
+
+	void add(SearchStats *stats)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		live.push_back(stats);
+	}
+
+	void retire(SearchStats *stats)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		retired.add(*stats);
+		live.erase(std::find(live.begin(),live.end(),stats));
+	}
+
+	SearchStats total()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		SearchStats sum = retired;
+		for(const SearchStats *stats: live)
+		{
+			sum.add(*stats);
+		}
+		return sum;
+	}
+
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		retired = SearchStats();
+		for(SearchStats *stats: live)
+		{
+			*stats = SearchStats();
+		}
+	}
+
+	private:
+	std::mutex mutex;
+	std::vector<SearchStats*> live;
+	SearchStats retired;
 };
 
-uint64_t DNA4::highLengthMask = ~0ULL;
-uint64_t DNA4::lowLengthMask = ~0ULL;
-uint64_t DNA4::fullMask = ~0ULL;
-uint_fast8_t DNA4::length = 0;
+//registers the counts of the calling thread, they are retired when the thread exits
+void registerThreadSearchStats(SearchStats &stats)
+{
+	struct RetireOnExit
+	{
+		SearchStats &stats;
+		RetireOnExit(SearchStats &stats)
+		:stats(stats)
+		{
+			SearchStatsRegistry::instance().add(&stats);
+		}
+		~RetireOnExit()
+		{
+			SearchStatsRegistry::instance().retire(&stats);
+		}
+	};
+	thread_local RetireOnExit retireOnExit(stats);
+}
+
+//the counts of the calling thread, they are constant initialised so counting into them only needs the registered check
+SearchStats &threadSearchStats()
+{
+	thread_local SearchStats stats;
+	thread_local bool registered = false;
+	if(!registered)
+	{
+		registerThreadSearchStats(stats);
+		registered = true;
+	}
+	return stats;
+}
+
+//the counts of every thread added up, threads that are still counting are read without synchronising
+//so call it while no scan or search is running
+SearchStats searchStats()
+{
+	return SearchStatsRegistry::instance().total();
+}
+
+//sets the counts of every thread to zero, while no scan or search is running
+void resetSearchStats()
+{
+	SearchStatsRegistry::instance().reset();
+}
+#endif
 
 class Filter
 {
 	public:
 	Filter(std::string s)
-	:filterSeq((std::string(DNA4::getLength()-s.size(),'x')+s).data()),numFilterChars(0)
+	:filterSeq((std::string(DNA4::getLength()-s.size(),'x')+s).data()),numFilterChars(0),ambiguousWindows(false)
 	{
 		if(s.size()==0)
 			return;
@@ -305,7 +584,9 @@ class Filter
 
 	bool passes(const DNA4 & seq) const
 	{
-		return filterSeq.getSimilarity(seq)==numFilterChars;
+		bool passing = filterSeq.getSimilarity(seq)==numFilterChars;
+		COUNT_SEARCH_STATS(stats.windowsScanned++; stats.windowsPassingFilter += passing);
+		return passing;
 	}
 
 	//adds filter characters to target in the positions where filter has matchable characters
@@ -321,9 +602,92 @@ class Filter
 
 	DNA4 asDNA4() const {return filterSeq;}
 
+	//the scanners only pass the windows whose characters are all bases to the action and jump over the runs of N
+	//and other ambiguous characters, unless the filter is set to keep the windows that have ambiguous characters
+	void keepAmbiguousWindows(bool keep = true) {ambiguousWindows = keep;}
+
+	bool keepsAmbiguousWindows() const {return ambiguousWindows;}
+
 	private:
 	DNA4 filterSeq;
 	uint_fast8_t numFilterChars;
+	bool ambiguousWindows;
+};
+
+//a sequence prepared to be compared with targets packed by DNA4::toTwoBits, which take half the memory of a DNA4
+//only the characters that the filter does not cover are compared in the packed form, see TwoBitComparison
+struct TwoBitSequence
+{
+	uint64_t characters;
+	//the low bit of the two bits of each character that is compared
+	uint64_t comparedBits;
+	//the low bit of each compared character of the sequence that is not a base, these never match
+	uint64_t unmatchable;
+	//the similarity to a target that has the same compared characters
+	uint32_t maxSimilarity;
+
+	//the number of characters of the sequence that match target, the same as DNA4::getSimilarity
+	uint32_t similarity(uint64_t target) const
+	{
+		uint64_t different = characters ^ target;
+		return maxSimilarity - __builtin_popcountll(((different | different >> 1) & comparedBits) | unmatchable);
+	}
+};
+
+//compares sequences with targets packed into two bits per character, targets must already have the filter characters added
+//a target can be packed when its characters outside the filter are exactly A, C, G or T and those under the filter are
+//exactly the filter's, then its similarity to a sequence is the similarity of the filter plus the matching packed characters
+class TwoBitComparison
+{
+	public:
+	TwoBitComparison(const Filter &filter)
+	:filterSeq(filter.asDNA4())
+	{
+		uint32_t filterPositions = anyCharacter(filterSeq);
+		variablePositions = ~filterPositions & uint32_t((1ULL<<DNA4::getLength())-1);
+		filterMask = filterPositions*((1ULL<<32)+1);
+		comparedBits = spreadBits(reverseBits(variablePositions));
+		numVariableChars = __builtin_popcount(variablePositions);
+	}
+
+	bool canPack(const DNA4 &target) const
+	{
+		return (target[0]&filterMask)==filterSeq[0] && (target[1]&filterMask)==filterSeq[1] &&
+				(exactCharacter(target) & variablePositions)==variablePositions;
+	}
+
+	//returns false if seq has a compared character that could be more than one base, those sequences have to be compared as DNA4
+	bool prepare(const DNA4 &seq, TwoBitSequence &packed) const
+	{
+		packed.characters = seq.toTwoBits();
+		uint32_t any = anyCharacter(seq);
+		if(any & ~exactCharacter(seq) & variablePositions)
+			return false;
+		packed.comparedBits = comparedBits;
+		packed.unmatchable = spreadBits(reverseBits(~any & variablePositions));
+		packed.maxSimilarity = numVariableChars + filterSeq.getSimilarity(seq);
+		return true;
+	}
+
+	private:
+	//a bit for each position that has a character
+	static uint32_t anyCharacter(const DNA4 &s)
+	{
+		return uint32_t(s[0]>>32) | uint32_t(s[0]) | uint32_t(s[1]>>32) | uint32_t(s[1]);
+	}
+
+	//a bit for each position that is exactly one base
+	static uint32_t exactCharacter(const DNA4 &s)
+	{
+		uint32_t a = s[0]>>32, c = s[0], g = s[1]>>32, t = s[1];
+		return (a|c|g|t) & ~((a&c)|(a&g)|(a&t)|(c&g)|(c&t)|(g&t));
+	}
+
+	DNA4 filterSeq;
+	uint64_t filterMask;
+	uint32_t variablePositions;
+	uint64_t comparedBits;
+	uint32_t numVariableChars;
 };
 
 template<uint32_t pow>
@@ -336,6 +700,43 @@ uint32_t pow2<0ul>()
 {
 	return 1ul;
 }
+//numThreads of 0 means all available cores, there is no point using more threads than jobs
+uint32_t numberOfThreadsToUse(uint32_t numThreads, size_t numJobs)
+{
+	if(numThreads==0)
+		numThreads = std::max(1u,std::thread::hardware_concurrency());
+	return std::max<size_t>(1,std::min<size_t>(numThreads,numJobs));
+}
+
+//calls job(jobNumber,threadNumber) for jobNumbers 0 to numJobs-1 using numThreads threads (0 uses all available cores)
+//threads take the next job when they finish one, so jobs are started in order
+//the jobs are run with the target length of the calling thread
+template<class Job>
+void runInParallel(size_t numJobs, uint32_t numThreads, Job &&job)
+{
+	numThreads = numberOfThreadsToUse(numThreads,numJobs);
+	std::atomic<size_t> nextJob(0);
+	const uint32_t length = DNA4::getLength();
+	auto doJobs = [&](uint32_t thread)
+	{
+		DNA4::setLength(length);
+		for(size_t jobNumber = nextJob++; jobNumber < numJobs; jobNumber = nextJob++)
+		{
+			job(jobNumber,thread);
+		}
+	};
+	std::vector<std::thread> threads;
+	for(uint32_t i = 1; i < numThreads; ++i)
+	{
+		threads.emplace_back(doJobs,i);
+	}
+	doJobs(0);
+	for(std::thread &t: threads)
+	{
+		t.join();
+	}
+}
+
 uint32_t nChooseK(uint32_t n,uint32_t k)
 {
     if (k > n) return 0;
@@ -385,662 +786,3231 @@ std::vector<DNA4> stringsToDNA4(const std::vector<std::string> &targetStrings)
 	return targets;
 }
 
+//an open addressing hash set laid out like a swiss table
+//each slot has a control byte that says whether it is empty, deleted, or holds a target with those 7 bits of hash
+//the slots are probed in groups whose control bytes are compared all at once
+//the targets can be split between several tables, or shards, by the top bits of their hash, see ConcurrentDNA4Set
 class DNA4Set
 {
 	public:
-	//the internal hash function used is based upon the filter
-	//inserting targets that do not pass the filter will be less efficient but still correct
-	DNA4Set(Filter filter = std::string())
-	:numTargets(0),buckets(nullptr),mask(0),offset(0)
-	{
-		//find postion and size of longest run of variable characters
-		calculateGoodFilter(filter.asDNA4());
-		buckets = new std::vector<DNA4>[mask+1];
-	}
+	//every character of a target is hashed so the filter is not needed
+	DNA4Set(Filter = std::string())
+	:shards(1)
+	{}
 
-	DNA4Set(const DNA4Set& o)
-	:numTargets(o.numTargets),buckets(new std::vector<DNA4>[o.mask+1]),mask(o.mask),offset(o.offset)
-	{
-		copyBuckets(o);
-	}
- 
-	// Move constructor
-	DNA4Set(DNA4Set&& o)
-	:numTargets(o.numTargets),buckets(o.buckets),mask(o.mask),offset(o.offset)
+	bool contains(DNA4 target) const
 	{
-		o.buckets = nullptr; 
+		uint64_t hash = hashTarget(target);
+		return shards[shardOf(hash)].contains(target,hash);
 	}
- 
-	// Copy assignment
-	DNA4Set& operator=(const DNA4Set& o)
-	{
-		// Self-assignment detection
-		if (&o == this)
-			return *this;
- 
-		//if we need a different number of buckets
-		if(mask!=o.mask)
-		{
-			delete[] buckets;
-			mask = o.mask;
-			buckets = new std::vector<DNA4>[o.mask+1];
-		}
-		numTargets = o.numTargets;
-		offset = o.offset;
-		copyBuckets(o);
 
-		return *this;
-	}
- 
-	// Move assignment
-	DNA4Set& operator=(DNA4Set&& o)
+	bool insert(DNA4 target)
 	{
-		// Self-assignment detection
-		if (&o == this)
-			return *this;
- 
-		delete[] buckets;
-
-		numTargets = o.numTargets;
-		buckets = o.buckets;
-		o.buckets = nullptr;
-		mask = o.mask;
-		offset = o.offset;
-
-		return *this;
+		uint64_t hash = hashTarget(target);
+		return shards[shardOf(hash)].insert(target,hash);
 	}
 
-	~DNA4Set()
+	bool remove(DNA4 target)
 	{
-		delete[] buckets;
+		uint64_t hash = hashTarget(target);
+		return shards[shardOf(hash)].remove(target,hash);
 	}
 
-	bool contains(DNA4 target)
+	size_t size() const
 	{
-		std::vector<DNA4> & bucket = getBucket(target);
-		for(uint32_t i = 0; i < bucket.size();++i)
+		size_t numTargets = 0;
+		for(const Table &shard: shards)
 		{
-			if(bucket[i]==target)
-				return true;
+			numTargets += shard.size();
 		}
-		return false;
+		return numTargets;
 	}
 
-	bool insert(DNA4 target)
+	std::vector<DNA4> getAllTargets() const
 	{
-		std::vector<DNA4> & bucket = getBucket(target);
-		for(uint32_t i = 0; i < bucket.size();++i)
+		std::vector<DNA4> targets;
+		targets.reserve(size());
+		for(const Table &shard: shards)
 		{
-			if(bucket[i]==target)
-				return false;
+			shard.getAllTargets(targets);
 		}
-		numTargets++;
-		bucket.push_back(target);
-		return true;
+		return targets;
 	}
 
-	bool remove(DNA4 target)
+	private:
+	friend class ConcurrentDNA4Set;
+
+	//shards are aligned to cache lines so threads working on neighbouring shards don't share one
+	class alignas(64) Table
 	{
-		std::vector<DNA4> & bucket = getBucket(target);
-		for(uint32_t i = 0; i < bucket.size();++i)
+		public:
+		Table()
+		:numTargets(0),growthLeft(0)
 		{
-			if(bucket[i]==target)
-			{
-				numTargets--;
-				bucket.erase(bucket.begin()+i);
-				return true;
-			}
+			rehash(groupSize);
 		}
-		return false;
-	}
 
-	size_t size() const {return numTargets;}
-
-	std::vector<DNA4> getAllTargets() const
-	{
-		std::vector<DNA4> targets(numTargets);
-		size_t total = 0;
-		for(uint32_t b = 0; b < mask+1; ++b)
+		bool contains(const DNA4 &target, uint64_t hash) const
 		{
-			auto &bucket = buckets[b];
-			for(uint32_t i = 0; i < bucket.size(); ++i)
-			{
-				targets[total] = bucket[i];
-				total++;
-			}
+			return findSlot(target,hash)!=noSlot;
 		}
-		return targets;
-	}
-
-	private:
 
-	inline void copyBuckets(const DNA4Set& o)
-	{
-		for(uint32_t i = 0; i < mask+1;++i)
+		bool insert(const DNA4 &target, uint64_t hash)
 		{
-			buckets[i] = o.buckets[i];
+			if(findSlot(target,hash)!=noSlot)
+				return false;
+			size_t slot = findFreeSlot(hash);
+			if(controls[slot]==empty && growthLeft==0)
+			{
+				//grow if the table is full of targets, otherwise it is full of deleted slots that can be reused
+				size_t capacity = slots.size();
+				rehash(numTargets+1 > capacity*7/16 ? capacity*2 : capacity);
+				slot = findFreeSlot(hash);
+			}
+			growthLeft -= controls[slot]==empty;
+			controls[slot] = hash & 0x7F;
+			slots[slot] = target;
+			numTargets++;
+			return true;
 		}
-	}
-
-	inline std::vector<DNA4> & getBucket(const DNA4 & target)
-	{
-		return buckets[((target[0]|target[1])>>offset)&mask];
-	}
 
-	void calculateGoodFilter(const DNA4 &filter)
-	{
-		int longestRun = 0;
-		int endOfLongestRun = 0;
-		int start = -1;
-		uint32_t H1 = filter.As();
-		uint32_t H2 = filter.Gs();
-		uint32_t L1 = filter.Cs();
-		uint32_t L2 = filter.Ts();
-		//all are the same or both sets of highs and lows are different
-		uint32_t equallyVariablePositions = (~((H1^L1) | (H2^L2) | (H1^H2))) |
-											((H1^H2) & (L1^L2));
-		for(uint32_t i = 0;i < DNA4::getLength();++i)
+		bool remove(const DNA4 &target, uint64_t hash)
 		{
-			//this is another variable position
-			if(equallyVariablePositions&(1ULL<<i))
+			size_t slot = findSlot(target,hash);
+			if(slot==noSlot)
+				return false;
+			//a search only moves on from a group without empty slots, so if the group has one the slot can be empty too
+			if(matchControl(&controls[slot/groupSize*groupSize],empty))
 			{
-				if(int(i-start) > longestRun)
-				{
-					endOfLongestRun = i;
-					longestRun = i-start;
-				}
+				controls[slot] = empty;
+				growthLeft++;
 			}
 			else
 			{
-				start=i;
+				controls[slot] = deleted;
 			}
+			numTargets--;
+			return true;
 		}
-		offset = endOfLongestRun-longestRun + 1;
-		longestRun = std::min(longestRun,20);
-		mask = (1ULL << longestRun)-1;
-	}
-
-	size_t numTargets;
-	std::vector<DNA4> * buckets;
-	uint64_t mask;
-	uint32_t offset;
-};
-
-class OffTargetFinder
-{
-
-	struct TargetBucket
-	{
-		DNA4 *begin_DNA;
-		uint32_t *begin_position;
-		uint64_t size;
-	};
 
-	class TargetContainer
-	{
-		public:
-		TargetContainer(uint32_t mismatches, Filter filter)
-		:buckets_DNA4(nullptr),buckets_positions(nullptr),bucketsForLastHash(nullptr),filter(filter),numberOfVariableChars(DNA4::getLength() - filter.numberOfFilterChars()),mismatches(mismatches),numTargets(0), good(false)
-		{}
+		size_t size() const {return numTargets;}
 
-		~TargetContainer()
+		void getAllTargets(std::vector<DNA4> &targets) const
 		{
-			delete[] buckets_DNA4;
-			delete[] buckets_positions;
-			delete[] bucketsForLastHash;
+			for(size_t i = 0; i < slots.size(); ++i)
+			{
+				if(controls[i] >= 0)
+					targets.push_back(slots[i]);
+			}
 		}
 
-		bool addTargets(const std::vector<DNA4> &targets,uint64_t maxIndexSize = ~0ULL)
+		private:
+		static constexpr size_t groupSize = 16;
+		static constexpr size_t noSlot = ~size_t(0);
+		static constexpr int8_t empty = -128;
+		static constexpr int8_t deleted = -2;
+
+		//returns a bit for each control byte of the group that is value
+		static uint32_t matchControl(const int8_t *group, int8_t value)
 		{
-			numTargets = targets.size();
-			uint32_t numberOfDivisions = optimumNumberOfDivisions(maxIndexSize);
-			if(!good)
-				return false;
-			uint32_t totalBuckets = numberOfDivisions*arrangementsPerDivision*bucketsPerArrangement;
-			totalHashmaps = numberOfDivisions*arrangementsPerDivision;
-			buckets_positions = new std::vector<uint32_t>[totalBuckets];
-			bucketsForLastHash = new uint32_t[totalHashmaps];
-			createHashHelpers(numberOfDivisions,mismatchesPerDivision);	
-			putTargetsInHashmaps(targets);
-			buckets_DNA4 = new std::vector<DNA4>[totalBuckets];
-			for(uint i = 0; i < totalBuckets;++i)
-			{
-				std::vector<uint32_t> &bucket = buckets_positions[i];
-				buckets_DNA4[i] = std::vector<DNA4>(bucket.size());
-				for(uint j = 0; j < bucket.size(); j++)
-				{
-					buckets_DNA4[i][j] = targets[buckets_positions[i][j]];
-				}
+		#if defined(__SSE2__)
+			__m128i controlBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+			return _mm_movemask_epi8(_mm_cmpeq_epi8(controlBytes,_mm_set1_epi8(value)));
+		#else
+			uint32_t matches = 0;
+			for(uint32_t i = 0; i < groupSize; ++i)
+			{
+				matches |= uint32_t(group[i]==value) << i;
 			}
-			return true;
+			return matches;
+		#endif
 		}
 
-		//returns the optimum number of divisions to use, if it is not worth using divisions zero is returned
-		uint32_t optimumNumberOfDivisions(uint64_t maxIndexSize)
+		//returns a bit for each slot of the group that is empty or deleted, which are the control bytes with the sign bit set
+		static uint32_t matchFree(const int8_t *group)
 		{
-			if(numberOfVariableChars<mismatches)
-				return 0;
-			//std::cout << "Divisions\tdivisionSize\tmismatchesPerDivision\tarrangementsPerDivision\ttargetsPerBucket\ttotalWork\ttotalSize"<<std::endl;
-			//calculate the optimum division size
-			uint64_t minimumTotalWork = numTargets;
-			uint32_t bestNumberOfDivisions = 0;
-			for(uint32_t divisions = 1; divisions <= numberOfVariableChars; ++divisions)
-			{
-				divisionSize = numberOfVariableChars/divisions;//round down
-				uint32_t mismatchesPerDivision = mismatches/divisions;//round down
-				arrangementsPerDivision = nChooseK(divisionSize,mismatchesPerDivision);
-				bucketsPerArrangement = std::pow(4,divisionSize-mismatchesPerDivision);//where 4 is the size of the alphabet
-				uint64_t totalSize = arrangementsPerDivision*divisions*(bucketsPerArrangement*sizeof(std::vector<std::pair<DNA4,uint32_t> >) + numTargets*(sizeof(std::pair<DNA4,uint32_t>)));
-				//overhead to generate a hash for each arrangement within each division is approximately = numberOfVariableChars
-				//each arrangement contains on average targets/bucketsPerArrangement
-				double totalWork = (numberOfVariableChars*10+numTargets/bucketsPerArrangement)*(arrangementsPerDivision*divisions);
-				if(totalWork < minimumTotalWork&&totalSize<maxIndexSize)
-				{
-					minimumTotalWork = totalWork;
-					bestNumberOfDivisions = divisions;
-				}
-				//std::cout << divisions <<'\t'<< divisionSize <<'\t'<< mismatchesPerDivision <<'\t'<< arrangementsPerDivision <<'\t'<< numberOfTargets/bucketsPerArrangement <<'\t'<< totalWork << '\t'<< totalSize << std::endl;
+		#if defined(__SSE2__)
+			return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group)));
+		#else
+			uint32_t matches = 0;
+			for(uint32_t i = 0; i < groupSize; ++i)
+			{
+				matches |= uint32_t(group[i] < 0) << i;
 			}
-			if(bestNumberOfDivisions==0)
-				return 0;
-			good = true;
-			divisionSize = numberOfVariableChars/bestNumberOfDivisions;//round down
-			mismatchesPerDivision = mismatches/bestNumberOfDivisions;//round down
-			arrangementsPerDivision = nChooseK(divisionSize,mismatchesPerDivision);
-			bucketsPerArrangement = std::pow(4,divisionSize-mismatchesPerDivision);//where 4 is the size of the alphabet
-			//std::cout << bestNumberOfDivisions << std::endl;
-			
-			return bestNumberOfDivisions;
+			return matches;
+		#endif
 		}
 
-		void createHashHelpers(uint32_t numberOfDivisions, uint32_t mismatchesPerDivision)
+		//groups are probed quadratically starting from the group picked by the hash, which visits every group
+		//as the table is never more than 7/8 full every search reaches a group with an empty slot
+		size_t findSlot(const DNA4 &target, uint64_t hash) const
 		{
-			std::unique_ptr<uint32_t[]> positions(new uint32_t[numberOfVariableChars]);
-			uint32_t ithMatchableCharacter = 0;
-			for(uint32_t i = 0; i < numberOfVariableChars;++i)
+			const int8_t h2 = hash & 0x7F;
+			const size_t groupMask = slots.size()/groupSize - 1;
+			size_t group = (hash >> 7) & groupMask;
+			for(size_t probe = 1;; ++probe)
 			{
-				if(!filter.asDNA4().matchableCharacterAtPosition(ithMatchableCharacter))
+				const int8_t *groupControls = &controls[group*groupSize];
+				for(uint32_t matches = matchControl(groupControls,h2); matches; matches &= matches-1)
 				{
-					positions[i] = DNA4::getLength() - ithMatchableCharacter - 1;
+					size_t slot = group*groupSize + __builtin_ctz(matches);
+					if(slots[slot]==target)
+						return slot;
 				}
-				else
-				{
-					i--;
-				}	
-				ithMatchableCharacter++;
+				if(matchControl(groupControls,empty))
+					return noSlot;
+				group = (group+probe) & groupMask;
 			}
-			//positions now contains the position of each matchable character counting from the end
-			//if there was no filter or all the filter characters were at the end of the string then
-			//the array will just contain the numbers numberOfVariableChars-1 to 0 in decreasing order
-
-			for(uint32_t i = 0; i < numberOfDivisions;++i)
-			{
-				auto combinationsInDivision = getAllCombinations<uint32_t>(positions.get()+i*divisionSize,divisionSize,divisionSize-mismatchesPerDivision);
-				hashHelpers.insert(hashHelpers.end(),combinationsInDivision.begin(),combinationsInDivision.end());
-			}	
 		}
 
-		void getBuckets(const DNA4 &string, TargetBucket* bucketsForString)
+		size_t findFreeSlot(uint64_t hash) const
 		{
-			slowestHashInTheWorld(string);
-			for(uint32_t j = 0; j < totalHashmaps;j++)
+			const size_t groupMask = slots.size()/groupSize - 1;
+			size_t group = (hash >> 7) & groupMask;
+			for(size_t probe = 1;; ++probe)
 			{
-				uint32_t bucket = bucketsForLastHash[j];
-				bucketsForString[j] = TargetBucket{buckets_DNA4[bucket].data(),buckets_positions[bucket].data(),buckets_positions[bucket].size()};
+				uint32_t free = matchFree(&controls[group*groupSize]);
+				if(free)
+					return group*groupSize + __builtin_ctz(free);
+				group = (group+probe) & groupMask;
 			}
 		}
 
-		void slowestHashInTheWorld(const DNA4 &string) const
+		//moves the targets into a table with capacity slots, which also clears the deleted slots
+		void rehash(size_t capacity)
 		{
-			//bitmask of positions of each character
-		#pragma GCC diagnostic ignored "-Wnarrowing"
-			uint32_t chars[4] = {string[0]>>32,string[1]>>32,(uint32_t)string[0],uint32_t(string[1])};//the high 32 bits of DNA4 and the low 32 bits
-		#pragma GCC diagnostic pop
-			for(uint32_t i = 0; i < totalHashmaps; ++i)
+			std::vector<int8_t> oldControls(capacity,empty);
+			std::vector<DNA4> oldSlots(capacity);
+			controls.swap(oldControls);
+			slots.swap(oldSlots);
+			for(size_t i = 0; i < oldSlots.size(); ++i)
 			{
-				uint32_t hash = 0;
-				const std::vector<uint32_t> &relevantPositions = hashHelpers[i];
-				for(uint32_t j = 0; j < relevantPositions.size();j++)
+				if(oldControls[i] >= 0)
 				{
-					uint32_t pos = relevantPositions[j];
-					hash <<= 2;
-					//only uses 3 of the four character of the alphabet, the fourth is represented by 0's
-					//this will hash strings that contain non alphabet characters as if the had the 4th character there instead
-					hash |= ((chars[0]>>pos)&1UL) | ((chars[1]>>pos)&1UL)*2 | ((chars[2]>>pos)&1UL)*3;
+					size_t slot = findFreeSlot(hashTarget(oldSlots[i]));
+					controls[slot] = oldControls[i];
+					slots[slot] = oldSlots[i];
 				}
-				bucketsForLastHash[i] = bucketsPerArrangement*i + hash;
 			}
+			growthLeft = capacity*7/8 - numTargets;
 		}
 
-		void putTargetsInHashmaps(const std::vector<DNA4> &targets)
-		{
-			for(uint32_t i = 0; i < targets.size();++i)
-			{
-				DNA4 target = targets[i];
-				slowestHashInTheWorld(target);
-				for(uint32_t j = 0; j < totalHashmaps;j++)
-				{
-					buckets_positions[bucketsForLastHash[j]].push_back(i);
-				}
-			}
-		}
+		size_t numTargets;
+		//the number of empty slots that can be filled before the table has to grow
+		size_t growthLeft;
+		std::vector<int8_t> controls;
+		std::vector<DNA4> slots;
+	};
 
-		uint32_t numberOfTargets() const {return numTargets;}
+	//numberOfShards must be a power of two, up to maxShards
+	explicit DNA4Set(uint32_t numberOfShards)
+	:shards(numberOfShards)
+	{}
 
-		uint32_t numberOfHashmaps() const {return totalHashmaps;}
+	static constexpr uint32_t maxShards = 256;
 
-		operator bool(){return good;}
+	static uint64_t hashTarget(const DNA4 &target)
+	{
+		uint64_t hash = target[0] ^ (target[1]*0x9E3779B97F4A7C15ULL);
+		hash ^= hash >> 33;
+		hash *= 0xFF51AFD7ED558CCDULL;
+		hash ^= hash >> 33;
+		hash *= 0xC4CEB9FE1A85EC53ULL;
+		return hash ^ (hash >> 33);
+	}
 
-		private:
-		std::vector<DNA4> *buckets_DNA4;
-		std::vector<uint32_t> *buckets_positions;
-		mutable uint32_t * bucketsForLastHash;
-		std::vector<std::vector<uint32_t> > hashHelpers;
-		Filter filter;
-		uint32_t numberOfVariableChars;
-		uint32_t mismatches;
-		uint32_t numTargets;
-		bool good;
-		uint32_t divisionSize;
-		uint32_t mismatchesPerDivision;
-		uint32_t arrangementsPerDivision;
-		uint64_t bucketsPerArrangement;
-		uint32_t totalHashmaps;
-	};
+	//the shard is picked by the top 8 bits of the hash, which the tables only use once they have billions of slots
+	uint32_t shardOf(uint64_t hash) const
+	{
+		return (hash >> 56) & (shards.size()-1);
+	}
+
+	std::vector<Table> shards;
+};
+
+//a DNA4Set that several threads can insert to, remove from and search at the same time
+//the targets are split into shards by their hash and each shard has its own lock, so threads rarely wait for each other
+class ConcurrentDNA4Set
+{
 	public:
-	struct Position
+	ConcurrentDNA4Set(Filter = std::string())
+	:set(DNA4Set::maxShards),locks(new ShardLock[DNA4Set::maxShards])
+	{}
+
+	bool contains(DNA4 target) const
 	{
-		uint32_t seqID;
-		uint32_t positionInSeq;
-		bool operator!=(const Position& o)const{return seqID!=o.seqID||positionInSeq!=o.positionInSeq;}
-		bool operator==(const Position& o)const {return (*this)!=o;}
+		uint64_t hash = DNA4Set::hashTarget(target);
+		uint32_t shard = set.shardOf(hash);
+		std::lock_guard<std::mutex> lock(locks[shard].mutex);
+		return set.shards[shard].contains(target,hash);
+	}
+
+	bool insert(DNA4 target)
+	{
+		uint64_t hash = DNA4Set::hashTarget(target);
+		uint32_t shard = set.shardOf(hash);
+		std::lock_guard<std::mutex> lock(locks[shard].mutex);
+		return set.shards[shard].insert(target,hash);
+	}
+
+	bool remove(DNA4 target)
+	{
+		uint64_t hash = DNA4Set::hashTarget(target);
+		uint32_t shard = set.shardOf(hash);
+		std::lock_guard<std::mutex> lock(locks[shard].mutex);
+		return set.shards[shard].remove(target,hash);
+	}
+
+	//only exact when no other thread is changing the set
+	size_t size() const {return set.size();}
+
+	//moves the targets into a DNA4Set without copying or rehashing them, this set is left empty
+	//no other thread may be using the set
+	DNA4Set toDNA4Set()
+	{
+		DNA4Set targets(DNA4Set::maxShards);
+		std::swap(targets.shards,set.shards);
+		return targets;
+	}
+
+	private:
+	struct alignas(64) ShardLock
+	{
+		std::mutex mutex;
 	};
 
-	struct OffTarget
+	DNA4Set set;
+	std::unique_ptr<ShardLock[]> locks;
+};
+
+//brute force comparison of a sequence against targets stored as separate arrays of their AC and GT words
+//writes the index and similarity of every target with at least minSimilarity matching characters and returns how many there are
+typedef uint32_t (*CompareTargetsKernel)(const uint64_t *targetACs, const uint64_t *targetGTs, uint32_t numTargets, const DNA4 &seq, uint32_t minSimilarity, uint32_t *matchedTargets, uint8_t *similarities);
+
+//compares the targets from first to numTargets-1
+uint32_t compareRemainingTargets(uint32_t first, const uint64_t *targetACs, const uint64_t *targetGTs, uint32_t numTargets, const DNA4 &seq, uint32_t minSimilarity, uint32_t *matchedTargets, uint8_t *similarities)
+{
+	uint32_t numberOfMatches = 0;
+	for(uint32_t i = first; i < numTargets; ++i)
 	{
-		Position position;
-		DNA4 offTargetSequence;
-		bool exactMatchTo(DNA4 t)const {return offTargetSequence.getSimilarity(t)==DNA4::getLength();}
-		bool operator!=(const OffTarget &o)const { return o.position!=position||offTargetSequence!=o.offTargetSequence;}
-		bool operator==(const OffTarget &o)const { return (*this)!=o;}
-		std::string asString() const {return offTargetSequence.toString();}
+		uint32_t similarity = __builtin_popcountll((targetACs[i]&seq[0])|(targetGTs[i]&seq[1]));
+		//always write the target and only keep it if it matched, to avoid a hard to predict branch
+		matchedTargets[numberOfMatches] = i;
+		similarities[numberOfMatches] = similarity;
+		numberOfMatches += similarity>=minSimilarity;
+	}
+	return numberOfMatches;
+}
+
+uint32_t compareTargetsScalar(const uint64_t *targetACs, const uint64_t *targetGTs, uint32_t numTargets, const DNA4 &seq, uint32_t minSimilarity, uint32_t *matchedTargets, uint8_t *similarities)
+{
+	return compareRemainingTargets(0,targetACs,targetGTs,numTargets,seq,minSimilarity,matchedTargets,similarities);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+uint32_t compareTargetsAVX2(const uint64_t *targetACs, const uint64_t *targetGTs, uint32_t numTargets, const DNA4 &seq, uint32_t minSimilarity, uint32_t *matchedTargets, uint8_t *similarities)
+{
+	//popcount of each 64 bit lane using a lookup table of the popcount of each nibble
+	const __m256i nibblePopcount = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i lowNibbles = _mm256_set1_epi8(0x0F);
+	const __m256i seqAC = _mm256_set1_epi64x(seq[0]);
+	const __m256i seqGT = _mm256_set1_epi64x(seq[1]);
+	const __m256i belowMinimum = _mm256_set1_epi64x(int64_t(minSimilarity)-1);
+	uint32_t numberOfMatches = 0;
+	uint32_t i = 0;
+	for(; i+4 <= numTargets; i+=4)
+	{
+		__m256i ac = _mm256_loadu_si256((const __m256i*)(targetACs+i));
+		__m256i gt = _mm256_loadu_si256((const __m256i*)(targetGTs+i));
+		__m256i matching = _mm256_or_si256(_mm256_and_si256(ac,seqAC),_mm256_and_si256(gt,seqGT));
+		__m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(nibblePopcount,_mm256_and_si256(matching,lowNibbles)),
+										_mm256_shuffle_epi8(nibblePopcount,_mm256_and_si256(_mm256_srli_epi16(matching,4),lowNibbles)));
+		__m256i similarity = _mm256_sad_epu8(counts,_mm256_setzero_si256());
+		uint32_t matched = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(similarity,belowMinimum)));
+		if(matched)
+		{
+			alignas(32) uint64_t similarityOf[4];
+			_mm256_store_si256((__m256i*)similarityOf,similarity);
+			for(; matched; matched &= matched-1)
+			{
+				uint32_t lane = __builtin_ctz(matched);
+				matchedTargets[numberOfMatches] = i+lane;
+				similarities[numberOfMatches] = similarityOf[lane];
+				numberOfMatches++;
+			}
+		}
+	}
+	return compareRemainingTargets(i,targetACs,targetGTs,numTargets,seq,minSimilarity,matchedTargets+numberOfMatches,similarities+numberOfMatches)+numberOfMatches;
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+uint32_t compareTargetsAVX512(const uint64_t *targetACs, const uint64_t *targetGTs, uint32_t numTargets, const DNA4 &seq, uint32_t minSimilarity, uint32_t *matchedTargets, uint8_t *similarities)
+{
+	const __m512i seqAC = _mm512_set1_epi64(seq[0]);
+	const __m512i seqGT = _mm512_set1_epi64(seq[1]);
+	const __m512i minimum = _mm512_set1_epi64(minSimilarity);
+	uint32_t numberOfMatches = 0;
+	uint32_t i = 0;
+	for(; i+8 <= numTargets; i+=8)
+	{
+		__m512i ac = _mm512_loadu_si512(targetACs+i);
+		__m512i gt = _mm512_loadu_si512(targetGTs+i);
+		//(ac & seqAC) | (gt & seqGT), 0xEA is the truth table of (a & b) | c
+		__m512i similarity = _mm512_popcnt_epi64(_mm512_ternarylogic_epi64(ac,seqAC,_mm512_and_si512(gt,seqGT),0xEA));
+		uint32_t matched = _mm512_cmpge_epu64_mask(similarity,minimum);
+		if(matched)
+		{
+			alignas(64) uint64_t similarityOf[8];
+			_mm512_store_si512(similarityOf,similarity);
+			for(; matched; matched &= matched-1)
+			{
+				uint32_t lane = __builtin_ctz(matched);
+				matchedTargets[numberOfMatches] = i+lane;
+				similarities[numberOfMatches] = similarityOf[lane];
+				numberOfMatches++;
+			}
+		}
+	}
+	return compareRemainingTargets(i,targetACs,targetGTs,numTargets,seq,minSimilarity,matchedTargets+numberOfMatches,similarities+numberOfMatches)+numberOfMatches;
+}
+#endif
+
+//picks the widest kernel the cpu supports
+CompareTargetsKernel bestCompareTargetsKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq"))
+		return compareTargetsAVX512;
+	if(__builtin_cpu_supports("avx2"))
+		return compareTargetsAVX2;
+#endif
+	return compareTargetsScalar;
+}
+
+//brute force comparison of a sequence against targets packed by DNA4::toTwoBits, the same as CompareTargetsKernel otherwise
+typedef uint32_t (*CompareTwoBitTargetsKernel)(const uint64_t *targets, uint32_t numTargets, const TwoBitSequence &seq, uint32_t minSimilarity, uint32_t *matchedTargets, uint8_t *similarities);
+
+uint32_t compareRemainingTwoBitTargets(uint32_t first, const uint64_t *targets, uint32_t numTargets, const TwoBitSequence &seq, uint32_t minSimilarity, uint32_t *matchedTargets, uint8_t *similarities)
+{
+	uint32_t numberOfMatches = 0;
+	for(uint32_t i = first; i < numTargets; ++i)
+	{
+		uint32_t similarity = seq.similarity(targets[i]);
+		matchedTargets[numberOfMatches] = i;
+		similarities[numberOfMatches] = similarity;
+		numberOfMatches += similarity>=minSimilarity;
+	}
+	return numberOfMatches;
+}
+
+uint32_t compareTwoBitTargetsScalar(const uint64_t *targets, uint32_t numTargets, const TwoBitSequence &seq, uint32_t minSimilarity, uint32_t *matchedTargets, uint8_t *similarities)
+{
+	return compareRemainingTwoBitTargets(0,targets,numTargets,seq,minSimilarity,matchedTargets,similarities);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+uint32_t compareTwoBitTargetsAVX2(const uint64_t *targets, uint32_t numTargets, const TwoBitSequence &seq, uint32_t minSimilarity, uint32_t *matchedTargets, uint8_t *similarities)
+{
+	if(seq.maxSimilarity < minSimilarity)
+		return 0;
+	const __m256i nibblePopcount = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i lowNibbles = _mm256_set1_epi8(0x0F);
+	const __m256i characters = _mm256_set1_epi64x(seq.characters);
+	const __m256i comparedBits = _mm256_set1_epi64x(seq.comparedBits);
+	const __m256i unmatchable = _mm256_set1_epi64x(seq.unmatchable);
+	const __m256i aboveMaximum = _mm256_set1_epi64x(int64_t(seq.maxSimilarity-minSimilarity)+1);
+	uint32_t numberOfMatches = 0;
+	uint32_t i = 0;
+	for(; i+4 <= numTargets; i+=4)
+	{
+		__m256i different = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(targets+i)),characters);
+		__m256i mismatching = _mm256_or_si256(_mm256_and_si256(_mm256_or_si256(different,_mm256_srli_epi64(different,1)),comparedBits),unmatchable);
+		//only bits 0, 2, 4 and 6 of each byte can be set, b | b>>3 moves them all into the low nibble so each byte takes one lookup
+		__m256i counts = _mm256_shuffle_epi8(nibblePopcount,_mm256_and_si256(_mm256_or_si256(mismatching,_mm256_srli_epi16(mismatching,3)),lowNibbles));
+		__m256i mismatches = _mm256_sad_epu8(counts,_mm256_setzero_si256());
+		uint32_t matched = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(aboveMaximum,mismatches)));
+		if(matched)
+		{
+			alignas(32) uint64_t mismatchesOf[4];
+			_mm256_store_si256((__m256i*)mismatchesOf,mismatches);
+			for(; matched; matched &= matched-1)
+			{
+				uint32_t lane = __builtin_ctz(matched);
+				matchedTargets[numberOfMatches] = i+lane;
+				similarities[numberOfMatches] = seq.maxSimilarity-mismatchesOf[lane];
+				numberOfMatches++;
+			}
+		}
+	}
+	return compareRemainingTwoBitTargets(i,targets,numTargets,seq,minSimilarity,matchedTargets+numberOfMatches,similarities+numberOfMatches)+numberOfMatches;
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+uint32_t compareTwoBitTargetsAVX512(const uint64_t *targets, uint32_t numTargets, const TwoBitSequence &seq, uint32_t minSimilarity, uint32_t *matchedTargets, uint8_t *similarities)
+{
+	if(seq.maxSimilarity < minSimilarity)
+		return 0;
+	//the characters are folded into the high bit of each pair instead of the low bit, as different+different is different<<1
+	const __m512i characters = _mm512_set1_epi64(seq.characters);
+	const __m512i comparedBits = _mm512_set1_epi64(seq.comparedBits << 1);
+	const __m512i unmatchable = _mm512_set1_epi64(seq.unmatchable << 1);
+	const __m512i maximum = _mm512_set1_epi64(seq.maxSimilarity-minSimilarity);
+	uint32_t numberOfMatches = 0;
+	uint32_t i = 0;
+	for(; i+8 <= numTargets; i+=8)
+	{
+		__m512i different = _mm512_xor_si512(_mm512_loadu_si512(targets+i),characters);
+		//((different | different<<1) & comparedBits) | unmatchable, 0xA8 is the truth table of (a | b) & c
+		__m512i mismatches = _mm512_popcnt_epi64(_mm512_or_si512(_mm512_ternarylogic_epi64(different,_mm512_add_epi64(different,different),comparedBits,0xA8),unmatchable));
+		uint32_t matched = _mm512_cmple_epu64_mask(mismatches,maximum);
+		if(matched)
+		{
+			alignas(64) uint64_t mismatchesOf[8];
+			_mm512_store_si512(mismatchesOf,mismatches);
+			for(; matched; matched &= matched-1)
+			{
+				uint32_t lane = __builtin_ctz(matched);
+				matchedTargets[numberOfMatches] = i+lane;
+				similarities[numberOfMatches] = seq.maxSimilarity-mismatchesOf[lane];
+				numberOfMatches++;
+			}
+		}
+	}
+	return compareRemainingTwoBitTargets(i,targets,numTargets,seq,minSimilarity,matchedTargets+numberOfMatches,similarities+numberOfMatches)+numberOfMatches;
+}
+#endif
+
+//picks the widest kernel the cpu supports
+CompareTwoBitTargetsKernel bestCompareTwoBitTargetsKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq"))
+		return compareTwoBitTargetsAVX512;
+	if(__builtin_cpu_supports("avx2"))
+		return compareTwoBitTargetsAVX2;
+#endif
+	return compareTwoBitTargetsScalar;
+}
+
+//an array of the index that either holds its own values, or refers to values owned by something else such as a mapped index file
+template<class T>
+class IndexArray
+{
+	public:
+	IndexArray()
+	:first(nullptr),count(0)
+	{}
+
+	IndexArray(const IndexArray &o)
+	:values(o.values),first(o.values.empty() ? o.first : values.data()),count(o.count)
+	{}
+
+	IndexArray(IndexArray &&o) = default;
+
+	IndexArray& operator=(IndexArray o)
+	{
+		std::swap(values,o.values);
+		std::swap(first,o.first);
+		std::swap(count,o.count);
+		return *this;
+	}
+
+	//makes the array hold size copies of value, and returns them so they can be filled in
+	T *assign(size_t size, const T &value = T())
+	{
+		values.assign(size,value);
+		first = values.data();
+		count = size;
+		return values.data();
+	}
+
+	//makes the array refer to size values from mapped, which must outlive the array
+	void refer(const T *mapped, size_t size)
+	{
+		std::vector<T>().swap(values);
+		first = mapped;
+		count = size;
+	}
+
+	const T &operator[](size_t i) const {return first[i];}
+	const T *data() const {return first;}
+	size_t size() const {return count;}
+
+	private:
+	std::vector<T> values;
+	const T *first;
+	size_t count;
+};
+
+//one way of searching the targets considered when building an OffTargetFinder, the simple method if divisions is 0
+struct IndexConfiguration
+{
+	uint32_t divisions;
+	uint32_t divisionSize;
+	uint32_t mismatchesPerDivision;
+	uint32_t arrangementsPerDivision;
+	uint64_t bucketsPerArrangement;
+	//the number of targets compared for each hashmap probed, estimated from a sample of the targets so it includes their skew
+	double targetsPerBucket;
+	//bytes
+	uint64_t size;
+	//the predicted time to search for one sequence
+	double predictedNanoseconds;
+};
+
+//the costs on this machine of the steps of a search, measured once by calibrated, used to choose between the simple and index methods
+class IndexCostModel
+{
+	public:
+	//nanoseconds to gather the hash of one hashmap from the characters of a sequence
+	double hashNanoseconds;
+	//nanoseconds to compare a sequence with one target of a bucket
+	double verifyNanoseconds;
+	//nanoseconds per probe to sort 2^16 probes of a batch by bucket
+	double sortNanoseconds;
+
+	static const IndexCostModel &calibrated()
+	{
+		static const IndexCostModel model;
+		return model;
+	}
+
+	//nanoseconds for a read from a random place in an array of size bytes
+	double randomReadNanoseconds(uint64_t bytes) const
+	{
+		uint32_t i = 0;
+		while(i+1 < numReadSizes && (1ULL << (firstReadSize+i)) < bytes)
+		{
+			i++;
+		}
+		return readNanoseconds[i];
+	}
+
+	//nanoseconds per probe to sort numProbes probes by bucket
+	double sortNanosecondsPerProbe(uint64_t numProbes) const
+	{
+		return sortNanoseconds*std::max(1.0,std::log2(double(numProbes)))/16;
+	}
+
+	//nanoseconds to compare a sequence with every one of numTargets targets by the brute force kernel
+	double simpleNanoseconds(uint64_t numTargets, bool twoBit) const
+	{
+		const double *perTarget = twoBit ? twoBitCompareNanoseconds : compareNanoseconds;
+		uint32_t i = 0;
+		while(i+1 < numCompareSizes && (1ULL << (firstCompareSize+2*i)) < numTargets)
+		{
+			i++;
+		}
+		return numTargets*perTarget[i];
+	}
+
+	private:
+	//random reads are measured in arrays of 2^firstReadSize to 2^(firstReadSize+numReadSizes-1) bytes
+	static constexpr uint32_t firstReadSize = 15;
+	static constexpr uint32_t numReadSizes = 11;
+	double readNanoseconds[numReadSizes];
+	//the brute force kernels are measured with 2^firstCompareSize to 2^(firstCompareSize+2*(numCompareSizes-1)) targets
+	static constexpr uint32_t firstCompareSize = 12;
+	static constexpr uint32_t numCompareSizes = 5;
+	//nanoseconds per target of the brute force kernels
+	double compareNanoseconds[numCompareSizes];
+	double twoBitCompareNanoseconds[numCompareSizes];
+
+	IndexCostModel()
+	{
+		TraceScope trace("calibrate cost model");
+		uint64_t random = 0x9E3779B97F4A7C15ULL;
+		auto nextRandom = [&]()
+		{
+			random ^= random << 13;
+			random ^= random >> 7;
+			random ^= random << 17;
+			return random;
+		};
+		auto nanosecondsPer = [](uint64_t count, auto &&work)
+		{
+			auto start = std::chrono::steady_clock::now();
+			work();
+			return std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-start).count()/count;
+		};
+		//the probes of the hashmaps do not depend on each other, so the reads are independent and can overlap like theirs
+		std::vector<uint32_t> array((1ULL << (firstReadSize+numReadSizes-1))/sizeof(uint32_t),1);
+		volatile uint64_t sink = 0;
+		for(uint32_t i = 0; i < numReadSizes; ++i)
+		{
+			uint64_t slotMask = (1ULL << (firstReadSize+i))/sizeof(uint32_t)-1;
+			const uint32_t reads = 1 << 16;
+			readNanoseconds[i] = nanosecondsPer(reads,[&]()
+			{
+				uint64_t sum = 0;
+				for(uint32_t j = 0; j < reads; ++j)
+					sum += array[nextRandom() & slotMask];
+				sink = sink + sum;
+			});
+		}
+		std::vector<uint32_t>().swap(array);
+
+		const uint32_t maxTargets = 1 << (firstCompareSize+2*(numCompareSizes-1));
+		std::vector<uint64_t> targetACs(maxTargets), targetGTs(maxTargets), packed(maxTargets);
+		for(uint32_t i = 0; i < maxTargets; ++i)
+		{
+			targetACs[i] = nextRandom();
+			targetGTs[i] = nextRandom();
+			packed[i] = nextRandom();
+		}
+		std::vector<uint32_t> matchedTargets(maxTargets);
+		std::vector<uint8_t> similarities(maxTargets);
+		DNA4 seq;
+		seq[0] = nextRandom();
+		seq[1] = nextRandom();
+		//a maximum similarity of 64 so the kernels compare every target, none of which match
+		TwoBitSequence twoBitSeq{nextRandom(),0x5555555555555555ULL,0,64};
+		CompareTargetsKernel compare = bestCompareTargetsKernel();
+		CompareTwoBitTargetsKernel compareTwoBit = bestCompareTwoBitTargetsKernel();
+		for(uint32_t i = 0; i < numCompareSizes; ++i)
+		{
+			uint32_t numTargets = 1 << (firstCompareSize+2*i);
+			//every size compares maxTargets targets in all, the first pass brings the targets into the cache if they fit
+			uint32_t repeats = maxTargets/numTargets;
+			compare(targetACs.data(),targetGTs.data(),numTargets,seq,64,matchedTargets.data(),similarities.data());
+			compareNanoseconds[i] = nanosecondsPer(maxTargets,[&]()
+			{
+				for(uint32_t r = 0; r < repeats; ++r)
+					sink = sink + compare(targetACs.data(),targetGTs.data(),numTargets,seq,64,matchedTargets.data(),similarities.data());
+			});
+			compareTwoBit(packed.data(),numTargets,twoBitSeq,64,matchedTargets.data(),similarities.data());
+			twoBitCompareNanoseconds[i] = nanosecondsPer(maxTargets,[&]()
+			{
+				for(uint32_t r = 0; r < repeats; ++r)
+					sink = sink + compareTwoBit(packed.data(),numTargets,twoBitSeq,64,matchedTargets.data(),similarities.data());
+			});
+		}
+
+		uint64_t masks[4];
+		for(uint64_t &mask: masks)
+			mask = nextRandom();
+		const uint32_t hashes = 1 << 16;
+		hashNanoseconds = nanosecondsPer(hashes,[&]()
+		{
+			uint64_t hash = 0;
+			for(uint32_t i = 0; i < hashes; ++i)
+				hash += gatherBits(packed[i]^hash,masks[i&3]);
+			sink = sink + hash;
+		});
+		std::vector<uint64_t> unsorted(packed.begin(),packed.begin()+(1 << 16));
+		sortNanoseconds = nanosecondsPer(unsorted.size(),[&]()
+		{
+			std::sort(unsorted.begin(),unsorted.end());
+		});
+		//like the batched search, each target of a bucket is compared with the sequences of the batch that probe it,
+		//which has OffTargetFinder::batchSize sequences
+		std::vector<TwoBitSequence> batch(1 << 14,twoBitSeq);
+		for(TwoBitSequence &batchSeq: batch)
+			batchSeq.characters = nextRandom();
+		std::vector<uint32_t> probes(1 << 16);
+		for(uint32_t &probe: probes)
+			probe = nextRandom() % batch.size();
+		verifyNanoseconds = nanosecondsPer(probes.size(),[&]()
+		{
+			uint32_t matches = 0;
+			for(uint32_t i = 0; i < probes.size(); ++i)
+			{
+				if(batch[probes[i]].similarity(packed[i/4]) >= 60)
+					matchedTargets[matches++] = i;
+			}
+			sink = sink + matches;
+		});
+	}
+};
+
+template<class Action>
+void doForTargetsInSequence(const char * sequence, size_t begin, size_t end, Filter filter, Action &&action);
+template<class Action>
+void doForTargetsOnBothStrands(const char * sequence, size_t begin, size_t end, Filter filter, Action &&action);
+
+class OffTargetFinder
+{
+	public:
+	//the number of divisions to build the index with that lets the planner choose, see printIndexPlan
+	static constexpr uint32_t plannedDivisions = ~0u;
+
+	private:
+	//the targets of a bucket are either DNA4s or, when every target could be packed, packed by DNA4::toTwoBits
+	struct TargetBucket
+	{
+		const DNA4 *begin_DNA;
+		const uint64_t *begin_twoBit;
+		const uint32_t *begin_position;
+		uint64_t size;
 	};
 
-	struct OffTargetContainer
+	//a bucket that holds so many more targets than the others, such as the bucket of low complexity or repetitive targets, that comparing
+	//a sequence with all of them would dominate the search, is split by the variable positions its hashmap does not hash
+	//every mismatch of a match from the bucket is in those positions, so they are dealt into mismatches+1 parts and each match is
+	//exactly the same as the sequence in at least one part, then each part has sub buckets of the targets that share some of its characters
+	struct SplitBucket
 	{
-		DNA4 target;
-		std::vector<OffTarget> * offtargets;
-		OffTargetContainer()
-			:offtargets(nullptr)
-		{}
-		OffTargetContainer(DNA4 target, int mismatches)
-		:target(target),offtargets(new std::vector<OffTarget>[mismatches+1])
+		uint32_t bucket;
+		uint32_t parts;
+		uint64_t size;
+		//the mask of the characters hashed by part p is splitMasks[firstMask+p]
+		uint64_t firstMask;
+		//the sub buckets of part p are from splitOffsets[firstOffset+p*(subBuckets+1)]
+		uint64_t firstOffset;
+		uint32_t subBuckets;
+		//the targets of part p sorted by sub bucket are from firstEntry+p*size in the split target arrays
+		uint64_t firstEntry;
+	};
+
+	//the targets compared with a sequence for each hashmap it probes, before and after the heavy buckets are split
+	struct BucketSplitting
+	{
+		uint64_t splitBuckets;
+		//the most targets a sequence is compared with from one hashmap
+		uint64_t largestBefore;
+		uint64_t largestAfter;
+		//averaged over the hashmaps and weighted by how often each bucket is probed, which is taken to be how often the targets are in it
+		double targetsPerProbeBefore;
+		double targetsPerProbeAfter;
+	};
+
+	class TargetContainer
+	{
+		public:
+		TargetContainer(uint32_t mismatches, Filter filter)
+		:filter(filter),numberOfVariableChars(DNA4::getLength() - filter.numberOfFilterChars()),mismatches(mismatches),numTargets(0), good(false), twoBitTargets(false), chosenConfiguration(0), smallestSplitBucket(~0ULL), splitting{0,0,0,0,0}
 		{}
-		~OffTargetContainer()
+
+		//the hashmaps are built using numThreads threads (0 uses all available cores)
+		//the index is split into the number of divisions predicted to search quickest unless divisions is not plannedDivisions
+		bool addTargets(const std::vector<DNA4> &targets,uint64_t maxIndexSize = ~0ULL, uint32_t numThreads = 0, uint32_t divisions = plannedDivisions)
 		{
-			delete[] offtargets;
+			numTargets = targets.size();
+			TwoBitComparison twoBitComparison(filter);
+			twoBitTargets = std::all_of(targets.begin(),targets.end(),[&](const DNA4 &t){return twoBitComparison.canPack(t);});
+			uint32_t numberOfDivisions = optimumNumberOfDivisions(targets,maxIndexSize,divisions);
+			if(!good)
+				return false;
+			totalHashmaps = numberOfDivisions*arrangementsPerDivision;
+			hashHelpers = arrangements(numberOfDivisions,divisionSize,mismatchesPerDivision);
+			createGatherMasks();
+			putTargetsInHashmaps(targets,numThreads);
+			splitHeavyBuckets();
+			return true;
 		}
-		std::vector<OffTarget> &operator[](int index)
+
+		//returns the number of divisions with the lowest predicted search time, zero if the simple method is quicker
+		//every configuration considered is kept in plan with its prediction, requestedDivisions overrides the choice
+		//unless it is plannedDivisions, zero asks for the simple method
+		uint32_t optimumNumberOfDivisions(const std::vector<DNA4> &targets, uint64_t maxIndexSize, uint32_t requestedDivisions)
 		{
-			return offtargets[index];
+			TraceScope trace("plan index");
+			const IndexCostModel &costs = IndexCostModel::calibrated();
+			plan.clear();
+			plan.push_back(IndexConfiguration{0,0,0,0,0,double(numTargets),0,costs.simpleNanoseconds(numTargets,twoBitTargets)});
+			size_t best = 0;
+			for(uint32_t divisions = 1; divisions <= numberOfVariableChars && numberOfVariableChars >= mismatches; ++divisions)
+			{
+				IndexConfiguration c;
+				c.divisions = divisions;
+				c.divisionSize = numberOfVariableChars/divisions;//round down
+				c.mismatchesPerDivision = mismatches/divisions;//round down
+				c.arrangementsPerDivision = nChooseK(c.divisionSize,c.mismatchesPerDivision);
+				//the buckets of every hashmap are numbered by 32 bits
+				uint32_t hashedChars = c.divisionSize-c.mismatchesPerDivision;
+				uint64_t hashmaps = uint64_t(c.arrangementsPerDivision)*divisions;
+				if(2*hashedChars >= 32 || (hashmaps << 2*hashedChars) >= (1ULL << 32))
+					continue;
+				c.bucketsPerArrangement = 1ULL << 2*hashedChars;//4 to the power of hashedChars, where 4 is the size of the alphabet
+				c.size = hashmaps*((c.bucketsPerArrangement+1)*sizeof(uint32_t) + numTargets*(bucketTargetSize()+sizeof(uint32_t)));
+				c.targetsPerBucket = sampleTargetsPerBucket(targets,arrangements(divisions,c.divisionSize,c.mismatchesPerDivision),c.bucketsPerArrangement);
+				//as in the batched search, each hashmap is hashed and the probes of the batch are sorted by bucket, then the offsets of the
+				//bucket are read and, unless it is empty, its first target, then the targets are compared
+				double offsetsNanoseconds = costs.randomReadNanoseconds(hashmaps*(c.bucketsPerArrangement+1)*sizeof(uint32_t));
+				double bucketNanoseconds = costs.randomReadNanoseconds(hashmaps*numTargets*bucketTargetSize());
+				c.predictedNanoseconds = hashmaps*(costs.hashNanoseconds + costs.sortNanosecondsPerProbe(hashmaps*batchSize) + offsetsNanoseconds +
+										std::min(1.0,c.targetsPerBucket)*bucketNanoseconds + c.targetsPerBucket*costs.verifyNanoseconds);
+				plan.push_back(c);
+				if(c.size <= maxIndexSize && c.predictedNanoseconds < plan[best].predictedNanoseconds)
+					best = plan.size()-1;
+			}
+			if(requestedDivisions!=plannedDivisions)
+			{
+				auto requested = std::find_if(plan.begin(),plan.end(),[&](const IndexConfiguration &c){return c.divisions==requestedDivisions;});
+				if(requested!=plan.end())
+					best = requested-plan.begin();
+				else
+					std::cout << "WARNING: the index can not be split into " << requestedDivisions << " divisions, using " << plan[best].divisions << " instead" << std::endl;
+			}
+			chosenConfiguration = best;
+			const IndexConfiguration &chosen = plan[best];
+			if(chosen.divisions==0)
+				return 0;
+			good = true;
+			divisionSize = chosen.divisionSize;
+			mismatchesPerDivision = chosen.mismatchesPerDivision;
+			arrangementsPerDivision = chosen.arrangementsPerDivision;
+			bucketsPerArrangement = chosen.bucketsPerArrangement;
+			return chosen.divisions;
 		}
-		std::vector<OffTarget> &getOffTargets(int distance)
+
+		//the targets in the bucket that a sequence probes in each hashmap, on average over the hashmaps and weighted by how often the bucket
+		//is probed, which is taken to be how often the targets are in it, so it is numTargets times the chance two targets share a bucket
+		//that chance is the fraction of pairs of a sample of the targets that share one in a sample of the hashmaps
+		double sampleTargetsPerBucket(const std::vector<DNA4> &targets, const std::vector<std::vector<uint32_t> > &hashmapPositions, uint64_t buckets) const
 		{
-			return offtargets[distance];
+			const uint32_t maxSampledTargets = 4096;
+			const uint32_t maxSampledHashmaps = 16;
+			std::vector<uint64_t> characters;
+			for(uint64_t i = 0; i < maxSampledTargets && i < numTargets; ++i)
+			{
+				characters.push_back(hashCharacters(targets[i*numTargets/std::min<uint64_t>(maxSampledTargets,numTargets)]));
+			}
+			uint64_t sharedPairs = 0;
+			uint64_t pairs = 0;
+			std::vector<uint32_t> hashes(characters.size());
+			uint32_t sampledHashmaps = std::min<size_t>(maxSampledHashmaps,hashmapPositions.size());
+			for(uint32_t h = 0; h < sampledHashmaps; ++h)
+			{
+				uint64_t mask = 0;
+				for(uint32_t pos: hashmapPositions[h*hashmapPositions.size()/sampledHashmaps])
+				{
+					mask |= 3ULL << 2*(31-pos);
+				}
+				for(size_t i = 0; i < characters.size(); ++i)
+				{
+					hashes[i] = gatherBits(characters[i],mask);
+				}
+				std::sort(hashes.begin(),hashes.end());
+				for(size_t first = 0; first < hashes.size();)
+				{
+					size_t last = first+1;
+					while(last < hashes.size() && hashes[last]==hashes[first])
+						last++;
+					sharedPairs += (last-first)*(last-first-1)/2;
+					first = last;
+				}
+				pairs += hashes.size()*(hashes.size()-1)/2;
+			}
+			//a sample too small to see any pairs sharing a bucket still shares them at least as often as uniform targets would
+			double uniform = double(numTargets)/buckets;
+			return pairs ? std::max(uniform,double(numTargets)*sharedPairs/pairs) : uniform;
 		}
-		std::vector<Position> getPositionsOfTarget()
+
+		//the positions hashed by each hashmap, the hashmaps of each division hash every arrangement of divisionSize-mismatchesPerDivision
+		//of its divisionSize positions
+		std::vector<std::vector<uint32_t> > arrangements(uint32_t numberOfDivisions, uint32_t divisionSize, uint32_t mismatchesPerDivision) const
+		{
+			std::vector<uint32_t> positions = variablePositions();
+			std::vector<std::vector<uint32_t> > allArrangements;
+			for(uint32_t i = 0; i < numberOfDivisions;++i)
+			{
+				auto combinationsInDivision = getAllCombinations<uint32_t>(positions.data()+i*divisionSize,divisionSize,divisionSize-mismatchesPerDivision);
+				allArrangements.insert(allArrangements.end(),combinationsInDivision.begin(),combinationsInDivision.end());
+			}
+			return allArrangements;
+		}
+
+		//the position of each character the filter does not cover, counting from the end
+		//if there was no filter or all the filter characters were at the end of the string then
+		//they are just the numbers numberOfVariableChars-1 to 0 in decreasing order
+		std::vector<uint32_t> variablePositions() const
+		{
+			std::vector<uint32_t> positions(numberOfVariableChars);
+			uint32_t ithMatchableCharacter = 0;
+			for(uint32_t i = 0; i < numberOfVariableChars;++i)
+			{
+				if(!filter.asDNA4().matchableCharacterAtPosition(ithMatchableCharacter))
+				{
+					positions[i] = DNA4::getLength() - ithMatchableCharacter - 1;
+				}
+				else
+				{
+					i--;
+				}	
+				ithMatchableCharacter++;
+			}
+			return positions;
+		}
+
+		//the configurations considered when the index was built and the one that was chosen, empty for a loaded index
+		const std::vector<IndexConfiguration> &indexPlan() const {return plan;}
+		size_t chosenIndexConfiguration() const {return chosenConfiguration;}
+
+		//each character of a hashed string is represented by two bits of a 64 bit word, see hash
+		//this turns the positions of each arrangement into a mask of the bits that make up its hash
+		//so the hash can be gathered with a single pext, or a few table lookups without BMI2
+		void createGatherMasks()
+		{
+			gatherMasks.assign(totalHashmaps,0);
+			gatherTableStart.assign(totalHashmaps+1,0);
+			gatherTableBytes.clear();
+			gatherTables.clear();
+			for(uint32_t i = 0; i < totalHashmaps; ++i)
+			{
+				for(uint32_t pos: hashHelpers[i])
+				{
+					gatherMasks[i] |= 3ULL << 2*(31-pos);
+				}
+			#if !defined(__BMI2__)
+				//the hash is the sum of the bits gathered from each byte that the mask covers
+				for(uint32_t byte = 0; byte < 8; ++byte)
+				{
+					if(((gatherMasks[i] >> 8*byte) & 0xFF)==0)
+						continue;
+					gatherTableBytes.push_back(byte);
+					for(uint64_t value = 0; value < 256; ++value)
+					{
+						gatherTables.push_back(gatherBits(value << 8*byte,gatherMasks[i]));
+					}
+				}
+			#endif
+				gatherTableStart[i+1] = gatherTableBytes.size();
+			}
+		}
+
+		//bucketsForHash is scratch space for totalHashmaps values
+		void getBuckets(const DNA4 &string, TargetBucket* bucketsForString, uint32_t* bucketsForHash) const
+		{
+			hash(string,bucketsForHash);
+			for(uint32_t j = 0; j < totalHashmaps;j++)
+			{
+				bucketsForString[j] = getBucket(bucketsForHash[j],j);
+			}
+		}
+
+		//bucket is a value written by hash
+		uint32_t hashmapOfBucket(uint32_t bucket) const
+		{
+			return bucket/bucketsPerArrangement;
+		}
+
+		TargetBucket getBucket(uint32_t bucket) const
+		{
+			return getBucket(bucket,hashmapOfBucket(bucket));
+		}
+
+		TargetBucket getBucket(uint32_t bucket, uint32_t hashmap) const
+		{
+			//each hashmap has one more offset than buckets so the offsets of bucket are at bucket+hashmap
+			const uint32_t *offsets = &bucketOffsets[bucket+hashmap];
+			size_t begin = uint64_t(numTargets)*hashmap + offsets[0];
+			if(twoBitTargets)
+				return TargetBucket{nullptr,bucketTwoBitTargets.data()+begin,&bucketTargetIndexes[begin],offsets[1]-offsets[0]};
+			return TargetBucket{bucketTargets.data()+begin,nullptr,&bucketTargetIndexes[begin],offsets[1]-offsets[0]};
+		}
+
+		//the characters of string as they are hashed, the two bits of DNA4::toTwoBits for each, the hash of hashmap i is the bits of gatherMasks[i]
+		//strings that contain non alphabet characters are hashed as if they had the characters they are packed as instead, the
+		//scanners only search for those when the filter keeps ambiguous windows
+		//positions are reversed so the first position of each arrangement is gathered into the most significant bits
+		static uint64_t hashCharacters(const DNA4 &string)
+		{
+			return string.toTwoBits();
+		}
+
+		//a target is found from every hashmap where it is in the same bucket as the string searched for, which is
+		//every hashmap whose mask covers no character where they differ, so each match is only kept from the first
+		//of those hashmaps, this is true if the target with targetCharacters was already found from a hashmap before hashmap
+		bool foundInEarlierHashmap(uint64_t stringCharacters, uint64_t targetCharacters, uint32_t hashmap) const
+		{
+			uint64_t differentCharacters = stringCharacters ^ targetCharacters;
+			const uint64_t *masks = gatherMasks.data();
+			for(uint32_t i = 0; i < hashmap; ++i)
+			{
+				if((differentCharacters & masks[i])==0)
+					return true;
+			}
+			return false;
+		}
+
+		//writes the bucket of string in each hashmap to bucketsForHash
+		void hash(const DNA4 &string, uint32_t* bucketsForHash) const
+		{
+			uint64_t chars = hashCharacters(string);
+			for(uint32_t i = 0; i < totalHashmaps; ++i)
+			{
+				bucketsForHash[i] = bucketsPerArrangement*i + hashInHashmap(chars,i);
+			}
+		}
+
+		//the bucket within hashmap of the string with the characters chars, see hashCharacters
+		uint32_t hashInHashmap(uint64_t chars, uint32_t hashmap) const
+		{
+		#if defined(__BMI2__)
+			return _pext_u64(chars,gatherMasks[hashmap]);
+		#else
+			const uint32_t *tableStart = gatherTableStart.data();
+			const uint8_t *tableBytes = gatherTableBytes.data();
+			const uint32_t *tables = gatherTables.data();
+			uint32_t hash = 0;
+			for(uint32_t j = tableStart[hashmap]; j < tableStart[hashmap+1]; ++j)
+			{
+				hash |= tables[j*256 + ((chars >> 8*tableBytes[j]) & 0xFF)];
+			}
+			return hash;
+		#endif
+		}
+
+		//every hashmap holds each target once, so the targets of hashmap j are stored contiguously
+		//from numTargets*j sorted by bucket, and the targets of bucket b of hashmap j are from
+		//bucketOffsets[j*(bucketsPerArrangement+1)+b] to bucketOffsets[j*(bucketsPerArrangement+1)+b+1]-1 in that range
+		//each hashmap only writes its own part of the arrays, so the hashmaps are built in parallel, one per job, each
+		//counting the targets in its buckets then filling them, so the arrays are allocated once at their final size
+		void putTargetsInHashmaps(const std::vector<DNA4> &targets, uint32_t numThreads)
+		{
+			TraceScope trace("fill hashmaps");
+			uint32_t *allOffsets = bucketOffsets.assign(totalHashmaps*(bucketsPerArrangement+1),0);
+			DNA4 *allTargets = twoBitTargets ? nullptr : bucketTargets.assign(uint64_t(numTargets)*totalHashmaps);
+			uint64_t *allTwoBitTargets = twoBitTargets ? bucketTwoBitTargets.assign(uint64_t(numTargets)*totalHashmaps) : nullptr;
+			uint32_t *allIndexes = bucketTargetIndexes.assign(uint64_t(numTargets)*totalHashmaps);
+			//the characters of each target are hashed by every hashmap so they are only worked out once, they are also the packed targets
+			std::vector<uint64_t> characters(numTargets);
+			const size_t targetsPerJob = 1<<16;
+			runInParallel((numTargets+targetsPerJob-1)/targetsPerJob,numThreads,[&](size_t job, uint32_t)
+			{
+				TraceScope trace("pack targets");
+				for(size_t i = job*targetsPerJob; i < std::min<size_t>(numTargets,(job+1)*targetsPerJob); ++i)
+				{
+					characters[i] = hashCharacters(targets[i]);
+				}
+			});
+		#ifdef FUZZY_MATCH_STATS
+			bucketOccupancy.assign(totalHashmaps,std::vector<uint64_t>());
+		#endif
+			runInParallel(totalHashmaps,numThreads,[&](size_t j, uint32_t)
+			{
+				TraceScope trace("fill hashmap");
+				//count the targets in each bucket
+				uint32_t *offsets = &allOffsets[j*(bucketsPerArrangement+1)];
+				for(uint32_t i = 0; i < numTargets;++i)
+				{
+					offsets[hashInHashmap(characters[i],j)]++;
+				}
+				//make each offset the end of its bucket
+				for(uint64_t b = 1; b <= bucketsPerArrangement;++b)
+				{
+					offsets[b] += offsets[b-1];
+				}
+				//fill the buckets from the end so the offsets end up at the start of their buckets
+				//and the targets within a bucket stay in order
+				size_t hashmapStart = uint64_t(numTargets)*j;
+				for(uint32_t i = numTargets; i-- > 0;)
+				{
+					size_t position = hashmapStart + --offsets[hashInHashmap(characters[i],j)];
+					if(twoBitTargets)
+						allTwoBitTargets[position] = characters[i];
+					else
+						allTargets[position] = targets[i];
+					allIndexes[position] = i;
+				}
+			#ifdef FUZZY_MATCH_STATS
+				recordBucketOccupancy(j);
+			#endif
+			});
+		}
+
+		//splits the buckets with at least heavyBucketFactor times as many targets as the average bucket, and at least minHeavyBucketSize,
+		//where that is predicted to at least halve the targets a sequence that probes them is compared with, see SplitBucket
+		//buckets with targets that could not be packed are not split, their characters that could be more than one base could match
+		//without being the same, so those matches might not be the same in any part, and there is nothing to split for fewer
+		//unhashed positions than parts
+		void splitHeavyBuckets()
+		{
+			TraceScope trace("split heavy buckets");
+			splitBuckets.clear();
+			splitMasks.clear();
+			splitOffsets.clear();
+			splitTargets.clear();
+			splitTwoBitTargets.clear();
+			splitTargetIndexes.clear();
+			smallestSplitBucket = ~0ULL;
+			splitting = BucketSplitting{0,0,0,0,0};
+			const uint32_t parts = mismatches+1;
+			const uint64_t heavyBucketSize = std::max<uint64_t>(minHeavyBucketSize,heavyBucketFactor*numTargets/bucketsPerArrangement);
+			const std::vector<uint32_t> positions = variablePositions();
+			TwoBitComparison twoBitComparison(filter);
+			double squaresBefore = 0;
+			double squaresAfter = 0;
+			std::vector<uint64_t> characters;
+			for(uint32_t j = 0; j < totalHashmaps; ++j)
+			{
+				//deal the positions this hashmap does not hash into the parts, in turn so each part has positions from the whole target
+				std::vector<std::vector<uint32_t> > partPositions(parts);
+				uint32_t unhashed = 0;
+				for(uint32_t pos: positions)
+				{
+					if(std::find(hashHelpers[j].begin(),hashHelpers[j].end(),pos)==hashHelpers[j].end())
+						partPositions[unhashed++ % parts].push_back(pos);
+				}
+				const uint32_t *offsets = &bucketOffsets[uint64_t(j)*(bucketsPerArrangement+1)];
+				for(uint64_t b = 0; b < bucketsPerArrangement; ++b)
+				{
+					uint64_t size = offsets[b+1]-offsets[b];
+					squaresBefore += double(size)*size;
+					splitting.largestBefore = std::max(splitting.largestBefore,size);
+					uint64_t begin = uint64_t(numTargets)*j + offsets[b];
+					bool splittable = size >= heavyBucketSize && unhashed >= parts;
+					if(splittable)
+					{
+						characters.resize(size);
+						for(uint64_t i = 0; i < size && splittable; ++i)
+						{
+							splittable = twoBitTargets || twoBitComparison.canPack(bucketTargets[begin+i]);
+							characters[i] = twoBitTargets ? bucketTwoBitTargets[begin+i] : hashCharacters(bucketTargets[begin+i]);
+						}
+					}
+					double comparedAfterSplit = 0;
+					uint64_t largestAfterSplit = 0;
+					if(splittable && trySplittingBucket(uint32_t(bucketsPerArrangement*j+b),begin,characters,partPositions,comparedAfterSplit,largestAfterSplit))
+					{
+						squaresAfter += size*comparedAfterSplit;
+						splitting.largestAfter = std::max(splitting.largestAfter,largestAfterSplit);
+					}
+					else
+					{
+						squaresAfter += double(size)*size;
+						splitting.largestAfter = std::max(splitting.largestAfter,size);
+					}
+				}
+			}
+			splitting.splitBuckets = splitBuckets.size();
+			splitting.targetsPerProbeBefore = squaresBefore/(double(numTargets)*totalHashmaps);
+			splitting.targetsPerProbeAfter = squaresAfter/(double(numTargets)*totalHashmaps);
+		}
+
+		//builds the parts of the bucket with the targets from begin, whose characters are characters, and keeps them if that is predicted to
+		//at least halve the targets a sequence that probes the bucket is compared with, compared is set to that prediction and largest to the
+		//most targets it can be compared with, each part hashes log4 of the size of the bucket of its positions so a sub bucket has a few targets
+		bool trySplittingBucket(uint32_t bucket, uint64_t begin, const std::vector<uint64_t> &characters,
+								const std::vector<std::vector<uint32_t> > &partPositions, double &compared, uint64_t &largest)
+		{
+			const uint32_t parts = partPositions.size();
+			const uint64_t size = characters.size();
+			uint32_t hashedPositions = 1;
+			while(hashedPositions < maxSplitHashedPositions && (1ULL << 2*hashedPositions) < size)
+				hashedPositions++;
+			for(const std::vector<uint32_t> &part: partPositions)
+			{
+				hashedPositions = std::min<uint32_t>(hashedPositions,part.size());
+			}
+			SplitBucket split{bucket,parts,size,splitMasks.size(),splitOffsets.size(),1U << 2*hashedPositions,splitTargetIndexes.size()};
+			//comparing with a sub bucket also costs reading its offsets, which takes about as long as comparing with a few targets
+			const double subBucketCost = 4;
+			compared = parts*subBucketCost;
+			largest = 0;
+			for(uint32_t p = 0; p < parts; ++p)
+			{
+				uint64_t mask = 0;
+				for(uint32_t i = 0; i < hashedPositions; ++i)
+				{
+					mask |= 3ULL << 2*(31-partPositions[p][i]);
+				}
+				splitMasks.push_back(mask);
+				//count the targets in each sub bucket, then fill them from the end so the targets stay in the order of the bucket
+				size_t firstOffset = splitOffsets.size();
+				splitOffsets.resize(firstOffset+split.subBuckets+1,0);
+				uint32_t *offsets = &splitOffsets[firstOffset];
+				for(uint64_t i = 0; i < size; ++i)
+				{
+					offsets[gatherBits(characters[i],mask)]++;
+				}
+				uint64_t largestSubBucket = 0;
+				for(uint32_t sub = 0; sub < split.subBuckets; ++sub)
+				{
+					compared += double(offsets[sub])*offsets[sub]/size;
+					largestSubBucket = std::max<uint64_t>(largestSubBucket,offsets[sub]);
+				}
+				largest += largestSubBucket;
+				for(uint32_t sub = 1; sub <= split.subBuckets; ++sub)
+				{
+					offsets[sub] += offsets[sub-1];
+				}
+				size_t firstEntry = splitTargetIndexes.size();
+				splitTargetIndexes.resize(firstEntry+size);
+				if(twoBitTargets)
+					splitTwoBitTargets.resize(firstEntry+size);
+				else
+					splitTargets.resize(firstEntry+size);
+				for(uint64_t i = size; i-- > 0;)
+				{
+					size_t entry = firstEntry + --offsets[gatherBits(characters[i],mask)];
+					if(twoBitTargets)
+						splitTwoBitTargets[entry] = bucketTwoBitTargets[begin+i];
+					else
+						splitTargets[entry] = bucketTargets[begin+i];
+					splitTargetIndexes[entry] = bucketTargetIndexes[begin+i];
+				}
+			}
+			if(2*compared >= size)
+			{
+				splitMasks.resize(split.firstMask);
+				splitOffsets.resize(split.firstOffset);
+				splitTargetIndexes.resize(split.firstEntry);
+				splitTwoBitTargets.resize(twoBitTargets ? split.firstEntry : 0);
+				splitTargets.resize(twoBitTargets ? 0 : split.firstEntry);
+				return false;
+			}
+			splitBuckets.push_back(split);
+			smallestSplitBucket = std::min(smallestSplitBucket,size);
+			return true;
+		}
+
+		//the split bucket of bucket, which has size targets, nullptr if it was not split
+		const SplitBucket *splitBucket(uint32_t bucket, uint64_t size) const
+		{
+			if(size < smallestSplitBucket)
+				return nullptr;
+			auto split = std::lower_bound(splitBuckets.begin(),splitBuckets.end(),bucket,[](const SplitBucket &s, uint32_t b){return s.bucket < b;});
+			return split!=splitBuckets.end() && split->bucket==bucket ? &*split : nullptr;
+		}
+
+		//the targets of part of split that share the characters hashed by the part with the string with the characters chars, see hashCharacters
+		TargetBucket getSubBucket(const SplitBucket &split, uint32_t part, uint64_t chars) const
+		{
+			const uint32_t *offsets = &splitOffsets[split.firstOffset + uint64_t(part)*(split.subBuckets+1) + gatherBits(chars,splitMasks[split.firstMask+part])];
+			size_t begin = split.firstEntry + part*split.size + offsets[0];
+			if(twoBitTargets)
+				return TargetBucket{nullptr,&splitTwoBitTargets[begin],&splitTargetIndexes[begin],offsets[1]-offsets[0]};
+			return TargetBucket{&splitTargets[begin],nullptr,&splitTargetIndexes[begin],offsets[1]-offsets[0]};
+		}
+
+		//a target is in the sub bucket of the string in every part where they have the same hashed characters, so like
+		//foundInEarlierHashmap each match is only kept from the first of those parts
+		bool foundInEarlierPart(uint64_t stringCharacters, uint64_t targetCharacters, const SplitBucket &split, uint32_t part) const
+		{
+			uint64_t differentCharacters = stringCharacters ^ targetCharacters;
+			for(uint32_t p = 0; p < part; ++p)
+			{
+				if((differentCharacters & splitMasks[split.firstMask+p])==0)
+					return true;
+			}
+			return false;
+		}
+
+		bool hasSplitBuckets() const {return splitBuckets.size();}
+
+		const BucketSplitting &bucketSplitting() const {return splitting;}
+
+	#ifdef FUZZY_MATCH_STATS
+		//the number of buckets of each size in each hashmap, see recordBucketOccupancy
+		const std::vector<std::vector<uint64_t> > &bucketOccupancyHistograms() const {return bucketOccupancy;}
+
+		//counts the buckets of hashmap by size, bucketOccupancy[hashmap][0] is the number of empty buckets
+		//and bucketOccupancy[hashmap][i] the number with 2^(i-1) to 2^i-1 targets
+		void recordBucketOccupancy(uint32_t hashmap)
+		{
+			const uint32_t *offsets = &bucketOffsets[hashmap*(bucketsPerArrangement+1)];
+			std::vector<uint64_t> &histogram = bucketOccupancy[hashmap];
+			histogram.assign(1,0);
+			for(uint64_t b = 0; b < bucketsPerArrangement; ++b)
+			{
+				uint32_t size = offsets[b+1]-offsets[b];
+				uint32_t bin = size ? 32-__builtin_clz(size) : 0;
+				if(bin >= histogram.size())
+					histogram.resize(bin+1,0);
+				histogram[bin]++;
+			}
+		}
+	#endif
+
+		uint32_t numberOfTargets() const {return numTargets;}
+
+		//true if the buckets hold the targets packed by DNA4::toTwoBits instead of as DNA4s
+		bool hasTwoBitTargets() const {return twoBitTargets;}
+
+		//the bytes taken by each target in a bucket
+		size_t bucketTargetSize() const {return twoBitTargets ? sizeof(uint64_t) : sizeof(DNA4);}
+
+		uint32_t numberOfHashmaps() const {return totalHashmaps;}
+
+		operator bool() const {return good;}
+
+		//writes the index and the targets it was built from to path so that load can use it without rebuilding it
+		//the file is in the byte order of this machine
+		bool save(const std::string &path, const std::vector<DNA4> &targets) const
+		{
+			if(!good)
+			{
+				std::cout << "ERROR: there is no index to save, the simple method is being used" << std::endl;
+				return false;
+			}
+			std::ofstream file(path,std::ios::binary);
+			if(!file)
+			{
+				std::cout << "ERROR: could not create index file \'" << path << "\'" << std::endl;
+				return false;
+			}
+			IndexFileHeader header;
+			memcpy(header.magic,indexFileMagic,sizeof(header.magic));
+			header.version = indexFileVersion;
+			header.byteOrder = indexFileByteOrder;
+			header.length = DNA4::getLength();
+			header.mismatches = mismatches;
+			header.numTargets = numTargets;
+			header.filter[0] = filter.asDNA4()[0];
+			header.filter[1] = filter.asDNA4()[1];
+			header.divisionSize = divisionSize;
+			header.mismatchesPerDivision = mismatchesPerDivision;
+			header.arrangementsPerDivision = arrangementsPerDivision;
+			header.totalHashmaps = totalHashmaps;
+			header.bucketsPerArrangement = bucketsPerArrangement;
+			header.twoBitTargets = twoBitTargets;
+			IndexFileLayout layout = indexFileLayout(header);
+			std::vector<uint32_t> positions;
+			for(const std::vector<uint32_t> &helper: hashHelpers)
+			{
+				positions.insert(positions.end(),helper.begin(),helper.end());
+			}
+			size_t written = 0;
+			auto writeAt = [&](size_t offset, const void *values, size_t bytes)
+			{
+				const std::vector<char> padding(offset-written,0);
+				file.write(padding.data(),padding.size());
+				file.write(static_cast<const char*>(values),bytes);
+				written = offset+bytes;
+			};
+			writeAt(0,&header,sizeof(header));
+			writeAt(layout.hashHelpers,positions.data(),positions.size()*sizeof(uint32_t));
+			writeAt(layout.targets,targets.data(),numTargets*sizeof(DNA4));
+			if(twoBitTargets)
+				writeAt(layout.bucketTargets,bucketTwoBitTargets.data(),bucketTwoBitTargets.size()*sizeof(uint64_t));
+			else
+				writeAt(layout.bucketTargets,bucketTargets.data(),bucketTargets.size()*sizeof(DNA4));
+			writeAt(layout.bucketTargetIndexes,bucketTargetIndexes.data(),bucketTargetIndexes.size()*sizeof(uint32_t));
+			writeAt(layout.bucketOffsets,bucketOffsets.data(),bucketOffsets.size()*sizeof(uint32_t));
+			file.close();
+			if(!file)
+			{
+				std::cout << "ERROR: could not write index file \'" << path << "\'" << std::endl;
+				return false;
+			}
+			return true;
+		}
+
+		//maps an index written by save and writes the targets it was built from to targets
+		//the buckets are used straight from the mapped file, so loading does not depend on the size of the index
+		//an index built for a different target length, number of mismatches or filter is rejected
+		bool load(const std::string &path, std::vector<DNA4> &targets)
+		{
+			TraceScope trace("load index");
+			std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+			if(!file->isOpen())
+				return false;
+			IndexFileHeader header;
+			if(file->size() < sizeof(header))
+			{
+				std::cout << "ERROR: \'" << path << "\' is not an index file" << std::endl;
+				return false;
+			}
+			memcpy(&header,file->begin(),sizeof(header));
+			if(memcmp(header.magic,indexFileMagic,sizeof(header.magic))!=0)
+			{
+				std::cout << "ERROR: \'" << path << "\' is not an index file" << std::endl;
+				return false;
+			}
+			if(header.version!=indexFileVersion || header.byteOrder!=indexFileByteOrder)
+			{
+				std::cout << "ERROR: index file \'" << path << "\' was written by a different version or on a machine with a different byte order, rebuild the index" << std::endl;
+				return false;
+			}
+			if(header.length!=DNA4::getLength())
+			{
+				std::cout << "ERROR: index file \'" << path << "\' is for targets of length " << header.length << ", the target length is " << DNA4::getLength() << std::endl;
+				return false;
+			}
+			if(header.mismatches!=mismatches)
+			{
+				std::cout << "ERROR: index file \'" << path << "\' is for " << header.mismatches << " mismatches, not " << mismatches << std::endl;
+				return false;
+			}
+			if(header.filter[0]!=filter.asDNA4()[0] || header.filter[1]!=filter.asDNA4()[1])
+			{
+				std::cout << "ERROR: index file \'" << path << "\' was built with a different filter" << std::endl;
+				return false;
+			}
+			if(!isConfigurationBuiltFor(header) || file->size() < indexFileLayout(header).end)
+			{
+				std::cout << "ERROR: index file \'" << path << "\' is damaged or incomplete" << std::endl;
+				return false;
+			}
+			IndexFileLayout layout = indexFileLayout(header);
+			const uint32_t *positions = reinterpret_cast<const uint32_t*>(file->begin()+layout.hashHelpers);
+			const uint32_t *offsets = reinterpret_cast<const uint32_t*>(file->begin()+layout.bucketOffsets);
+			bool positionsInTargets = std::all_of(positions,positions+uint64_t(header.totalHashmaps)*(header.divisionSize-header.mismatchesPerDivision),
+												  [](uint32_t position){return position < DNA4::getLength();});
+			//the offsets of each hashmap end with the number of targets, only the ends are read so loading stays quick
+			bool bucketsEndAtTargets = true;
+			for(uint32_t i = 0; i < header.totalHashmaps; ++i)
+			{
+				bucketsEndAtTargets &= offsets[i*(header.bucketsPerArrangement+1)]==0 &&
+									   offsets[i*(header.bucketsPerArrangement+1)+header.bucketsPerArrangement]==header.numTargets;
+			}
+			if(!positionsInTargets || !bucketsEndAtTargets)
+			{
+				std::cout << "ERROR: index file \'" << path << "\' is damaged or incomplete" << std::endl;
+				return false;
+			}
+			numTargets = header.numTargets;
+			divisionSize = header.divisionSize;
+			mismatchesPerDivision = header.mismatchesPerDivision;
+			arrangementsPerDivision = header.arrangementsPerDivision;
+			totalHashmaps = header.totalHashmaps;
+			bucketsPerArrangement = header.bucketsPerArrangement;
+			twoBitTargets = header.twoBitTargets;
+			const uint32_t positionsPerHashmap = divisionSize-mismatchesPerDivision;
+			hashHelpers.clear();
+			for(uint32_t i = 0; i < totalHashmaps; ++i)
+			{
+				hashHelpers.emplace_back(positions+i*positionsPerHashmap,positions+(i+1)*positionsPerHashmap);
+			}
+			createGatherMasks();
+			const DNA4 *originalTargets = reinterpret_cast<const DNA4*>(file->begin()+layout.targets);
+			targets.assign(originalTargets,originalTargets+numTargets);
+			if(twoBitTargets)
+				bucketTwoBitTargets.refer(reinterpret_cast<const uint64_t*>(file->begin()+layout.bucketTargets),uint64_t(numTargets)*totalHashmaps);
+			else
+				bucketTargets.refer(reinterpret_cast<const DNA4*>(file->begin()+layout.bucketTargets),uint64_t(numTargets)*totalHashmaps);
+			bucketTargetIndexes.refer(reinterpret_cast<const uint32_t*>(file->begin()+layout.bucketTargetIndexes),uint64_t(numTargets)*totalHashmaps);
+			bucketOffsets.refer(reinterpret_cast<const uint32_t*>(file->begin()+layout.bucketOffsets),totalHashmaps*(bucketsPerArrangement+1));
+			indexFile = file;
+			good = true;
+			splitHeavyBuckets();
+		#ifdef FUZZY_MATCH_STATS
+			bucketOccupancy.assign(totalHashmaps,std::vector<uint64_t>());
+			for(uint32_t j = 0; j < totalHashmaps; ++j)
+			{
+				recordBucketOccupancy(j);
+			}
+		#endif
+			return true;
+		}
+
+		private:
+		static constexpr char indexFileMagic[8] = {'F','Z','M','I','N','D','E','X'};
+		static constexpr uint32_t indexFileVersion = 2;
+		static constexpr uint32_t indexFileByteOrder = 0x01020304;
+		//every array of an index file starts on a cache line so it can be used in place once the file is mapped
+		static constexpr size_t indexFileAlignment = 64;
+
+		struct IndexFileHeader
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t byteOrder;
+			uint32_t length;
+			uint32_t mismatches;
+			uint32_t numTargets;
+			uint32_t divisionSize;
+			uint64_t filter[2];
+			uint32_t mismatchesPerDivision;
+			uint32_t arrangementsPerDivision;
+			uint32_t totalHashmaps;
+			//1 if the bucket targets are packed by DNA4::toTwoBits
+			uint32_t twoBitTargets;
+			uint64_t bucketsPerArrangement;
+		};
+
+		//the byte offset of each array in an index file
+		struct IndexFileLayout
+		{
+			size_t hashHelpers;
+			size_t targets;
+			size_t bucketTargets;
+			size_t bucketTargetIndexes;
+			size_t bucketOffsets;
+			size_t end;
+		};
+
+		//true if header describes an index that addTargets could have built for these targets, a number of divisions
+		//of the variable characters and the arrangements and buckets that follow from it
+		bool isConfigurationBuiltFor(const IndexFileHeader &header) const
+		{
+			if(header.arrangementsPerDivision==0 || header.totalHashmaps % header.arrangementsPerDivision!=0 || header.twoBitTargets > 1)
+				return false;
+			uint32_t divisions = header.totalHashmaps/header.arrangementsPerDivision;
+			if(divisions==0 || divisions > numberOfVariableChars || header.divisionSize!=numberOfVariableChars/divisions ||
+			   header.mismatchesPerDivision!=mismatches/divisions || header.mismatchesPerDivision > header.divisionSize)
+				return false;
+			uint32_t hashedChars = header.divisionSize-header.mismatchesPerDivision;
+			return header.arrangementsPerDivision==nChooseK(header.divisionSize,header.mismatchesPerDivision) &&
+				   2*hashedChars < 32 && header.bucketsPerArrangement==(1ULL << 2*hashedChars);
+		}
+
+		static IndexFileLayout indexFileLayout(const IndexFileHeader &header)
+		{
+			auto align = [](size_t offset){return (offset+indexFileAlignment-1)/indexFileAlignment*indexFileAlignment;};
+			uint64_t entries = uint64_t(header.numTargets)*header.totalHashmaps;
+			IndexFileLayout layout;
+			layout.hashHelpers = align(sizeof(IndexFileHeader));
+			layout.targets = align(layout.hashHelpers + uint64_t(header.totalHashmaps)*(header.divisionSize-header.mismatchesPerDivision)*sizeof(uint32_t));
+			layout.bucketTargets = align(layout.targets + uint64_t(header.numTargets)*sizeof(DNA4));
+			layout.bucketTargetIndexes = align(layout.bucketTargets + entries*(header.twoBitTargets ? sizeof(uint64_t) : sizeof(DNA4)));
+			layout.bucketOffsets = align(layout.bucketTargetIndexes + entries*sizeof(uint32_t));
+			layout.end = layout.bucketOffsets + header.totalHashmaps*(header.bucketsPerArrangement+1)*sizeof(uint32_t);
+			return layout;
+		}
+
+		//only one of the bucket target arrays is used, see twoBitTargets
+		IndexArray<DNA4> bucketTargets;
+		IndexArray<uint64_t> bucketTwoBitTargets;
+		IndexArray<uint32_t> bucketTargetIndexes;
+		IndexArray<uint32_t> bucketOffsets;
+		//the index file that the arrays refer to when the index was loaded instead of built
+		std::shared_ptr<MappedFile> indexFile;
+		std::vector<std::vector<uint32_t> > hashHelpers;
+		std::vector<uint64_t> gatherMasks;
+		//without BMI2 the hash of arrangement i is gathered by the lookup tables gatherTableStart[i] to gatherTableStart[i+1]-1
+		//each table has 256 entries, one for each value of byte gatherTableBytes[j] of the characters
+		std::vector<uint32_t> gatherTableStart;
+		std::vector<uint8_t> gatherTableBytes;
+		std::vector<uint32_t> gatherTables;
+		Filter filter;
+		uint32_t numberOfVariableChars;
+		uint32_t mismatches;
+		uint32_t numTargets;
+		bool good;
+		uint32_t divisionSize;
+		uint32_t mismatchesPerDivision;
+		uint32_t arrangementsPerDivision;
+		uint64_t bucketsPerArrangement;
+		uint32_t totalHashmaps;
+		bool twoBitTargets;
+		std::vector<IndexConfiguration> plan;
+		size_t chosenConfiguration;
+		//the heavy buckets that were split sorted by bucket, and their parts, see SplitBucket
+		static constexpr uint64_t minHeavyBucketSize = 64;
+		static constexpr uint64_t heavyBucketFactor = 8;
+		//a part of a split bucket hashes at most this many positions, so it has at most 4^10 sub buckets, a few MB of offsets
+		static constexpr uint32_t maxSplitHashedPositions = 10;
+		std::vector<SplitBucket> splitBuckets;
+		uint64_t smallestSplitBucket;
+		std::vector<uint64_t> splitMasks;
+		std::vector<uint32_t> splitOffsets;
+		//only one of the split target arrays is used, like the bucket target arrays
+		std::vector<DNA4> splitTargets;
+		std::vector<uint64_t> splitTwoBitTargets;
+		std::vector<uint32_t> splitTargetIndexes;
+		BucketSplitting splitting;
+	#ifdef FUZZY_MATCH_STATS
+		std::vector<std::vector<uint64_t> > bucketOccupancy;
+	#endif
+	};
+	public:
+	struct Position
+	{
+		uint32_t seqID;
+		//position of the first character on the forward strand, for both strands
+		uint32_t positionInSeq;
+		Strand strand;
+		bool operator!=(const Position& o)const{return seqID!=o.seqID||positionInSeq!=o.positionInSeq||strand!=o.strand;}
+		bool operator==(const Position& o)const {return !((*this)!=o);}
+	};
+
+	struct OffTarget
+	{
+		Position position;
+		DNA4 offTargetSequence;
+		bool exactMatchTo(DNA4 t)const {return offTargetSequence.getSimilarity(t)==DNA4::getLength();}
+		bool operator!=(const OffTarget &o)const { return o.position!=position||offTargetSequence!=o.offTargetSequence;}
+		bool operator==(const OffTarget &o)const { return !((*this)!=o);}
+		std::string asString() const {return offTargetSequence.toString();}
+	};
+
+	//an off target of the target targetIndex
+	struct Match
+	{
+		uint32_t targetIndex;
+		uint32_t mismatches;
+		OffTarget offTarget;
+	};
+
+	//receives the matches of the searches as they are found instead of them being stored in the off target containers
+	//the matches are passed in blocks, in the order a single threaded search finds them, and from only one thread at a time
+	class ResultSink
+	{
+		public:
+		virtual ~ResultSink() {}
+		virtual void addMatches(const Match *matches, size_t numMatches) = 0;
+		//called by OffTargetFinder::flushResults once all the matches found so far have been passed on
+		virtual void flush() {}
+	};
+
+	struct OffTargetContainer
+	{
+		DNA4 target;
+		std::vector<OffTarget> * offtargets;
+		OffTargetContainer()
+			:offtargets(nullptr)
+		{}
+		OffTargetContainer(DNA4 target, int mismatches)
+		:target(target),offtargets(new std::vector<OffTarget>[mismatches+1])
+		{}
+		~OffTargetContainer()
+		{
+			delete[] offtargets;
+		}
+		std::vector<OffTarget> &operator[](int index)
+		{
+			return offtargets[index];
+		}
+		std::vector<OffTarget> &getOffTargets(int distance)
+		{
+			return offtargets[distance];
+		}
+		std::vector<Position> getPositionsOfTarget()
+		{
+			std::vector<Position> p;
+			for(OffTarget &ot:offtargets[0])
+			{
+				if(ot.exactMatchTo(target))
+				{
+					p.push_back(ot.position);
+				}
+			}
+			return p;
+		}
+
+	};
+
+	//if countOnly is set the off targets are not stored, only the number of off targets of each target at each distance
+	//is counted, see numberOfOffTargets, the index is built using numThreads threads (0 uses all available cores)
+	//the index is split into divisions divisions, or the number predicted to be quickest for plannedDivisions, 0 uses the simple method
+	OffTargetFinder(const std::vector<DNA4> &targets, uint_fast8_t mismatches, Filter filter, uint64_t maxIndexSize = ~0ULL, bool countOnly = false, uint32_t numThreads = 0, uint32_t divisions = plannedDivisions)
+	:	targetContainer(mismatches,filter),
+		targets(targets),
+		compareTargets(bestCompareTargetsKernel()),
+		twoBitTargets(false),
+		twoBitComparison(filter),
+		compareTwoBitTargets(bestCompareTwoBitTargetsKernel()),
+		countOnly(countOnly),
+		resultSink(nullptr),
+		distances(mismatches+1)
+	{
+		if(targets.size()==0)
+		{
+			return;
+		}
+		TraceScope trace("build index");
+		addTargets(filter);
+		targetContainer.addTargets(this->targets,maxIndexSize,numThreads,divisions);
+		prepareSearch(mismatches);
+	}
+
+	//loads an index written by saveIndex instead of building it, the index file is mapped and shared with any other process using it
+	//if the index was built for a different target length, number of mismatches or filter it is rejected and there are no targets
+	OffTargetFinder(const std::string &indexFile, uint_fast8_t mismatches, Filter filter, bool countOnly = false)
+	:	targetContainer(mismatches,filter),
+		compareTargets(bestCompareTargetsKernel()),
+		twoBitTargets(false),
+		twoBitComparison(filter),
+		compareTwoBitTargets(bestCompareTwoBitTargetsKernel()),
+		countOnly(countOnly),
+		resultSink(nullptr),
+		distances(mismatches+1)
+	{
+		if(!targetContainer.load(indexFile,targets))
+		{
+			return;
+		}
+		addTargets(filter);
+		prepareSearch(mismatches);
+	}
+
+	//writes the index to indexFile so it can be loaded by later runs, only the index method has an index to save
+	bool saveIndex(const std::string &indexFile) const
+	{
+		return targetContainer.save(indexFile,originalTargets);
+	}
+
+	size_t numberOfTargets() const {return targets.size();}
+
+	//the configurations that were considered for the index with their predicted time to search for a sequence, the chosen one marked
+	//with a *, there is no plan for an index that was loaded, followed by how much splitting the heavy buckets saves, which an index
+	//that was loaded also has
+	void printIndexPlan(std::ostream &out = std::cout) const
+	{
+		const std::vector<IndexConfiguration> &plan = targetContainer.indexPlan();
+		out << "divisions\tdivisionSize\tmismatchesPerDivision\tarrangementsPerDivision\ttargetsPerBucket\tsize\tpredictedNanoseconds" << std::endl;
+		for(size_t i = 0; i < plan.size(); ++i)
+		{
+			const IndexConfiguration &c = plan[i];
+			out << c.divisions << (i==targetContainer.chosenIndexConfiguration() ? "*" : "") << '\t' << c.divisionSize << '\t' << c.mismatchesPerDivision << '\t'
+				<< c.arrangementsPerDivision << '\t' << c.targetsPerBucket << '\t' << c.size << '\t' << c.predictedNanoseconds << std::endl;
+		}
+		if(targetContainer)
+		{
+			const BucketSplitting &s = targetContainer.bucketSplitting();
+			out << "split " << s.splitBuckets << " heavy buckets, largest bucket " << s.largestBefore << " -> " << s.largestAfter
+				<< " targets compared, targets compared per probe " << s.targetsPerProbeBefore << " -> " << s.targetsPerProbeAfter << std::endl;
+		}
+	}
+
+#ifdef FUZZY_MATCH_STATS
+	//writes the counts of every scan and search so far, see searchStats, and the bucket occupancy of each hashmap of the index as json
+	//call it while no scan or search is running
+	void writeStats(std::ostream &out) const
+	{
+		out << "{\"search\": ";
+		searchStats().writeJSON(out);
+		out << ", \"index\": {\"method\": \"" << (targetContainer ? "index" : "simple") << "\", \"targets\": " << targets.size()
+			<< ", \"hashmaps\": " << (targetContainer ? targetContainer.numberOfHashmaps() : 0);
+		const BucketSplitting &splitting = targetContainer.bucketSplitting();
+		out << ", \"split_buckets\": " << splitting.splitBuckets << ", \"largest_bucket\": [" << splitting.largestBefore << ", " << splitting.largestAfter
+			<< "], \"targets_per_probe\": [" << splitting.targetsPerProbeBefore << ", " << splitting.targetsPerProbeAfter << "], \"bucket_occupancy\": [";
+		const std::vector<std::vector<uint64_t> > &occupancy = targetContainer.bucketOccupancyHistograms();
+		for(size_t j = 0; j < occupancy.size(); ++j)
+		{
+			out << (j ? ", [" : "[");
+			for(size_t bin = 0; bin < occupancy[j].size(); ++bin)
+			{
+				out << (bin ? ", " : "") << occupancy[j][bin];
+			}
+			out << "]";
+		}
+		out << "]}}" << std::endl;
+	}
+#endif
+
+	//the number of off targets of target that are distance mismatches away, in either mode
+	uint64_t numberOfOffTargets(uint32_t target, uint32_t distance) const
+	{
+		if(countOnly)
+		{
+			return offTargetCounts[uint64_t(target)*distances+distance];
+		}
+		return offTargets.empty() ? 0 : offTargets[target].offtargets[distance].size();
+	}
+
+	//the counts of a countOnly search, the count of target at distance d is at target*(mismatches+1)+d
+	const std::vector<uint64_t> &getOffTargetCounts() const
+	{
+		return offTargetCounts;
+	}
+
+	private:
+	//keeps the targets as they were given, creates the counts in countOnly mode and adds the filter characters to the targets
+	void addTargets(Filter filter)
+	{
+		originalTargets = targets;
+		if(countOnly)
+		{
+			offTargetCounts.assign(targets.size()*distances,0);
+		}
+		if(filter.exists())
+		{
+			for(DNA4 &t: targets)
+			{
+				filter.addFilterCharsToTarget(t);
+			}
+		}
+	}
+
+	void prepareSearch(uint_fast8_t mismatches)
+	{
+		if(targetContainer)
+		{
+			twoBitTargets = targetContainer.hasTwoBitTargets();
+		}
+		else
+		{
+			//the simple method compares every target so they are stored in a layout that can be compared several at a time
+			//packed into two bits per character if they all can be, otherwise as separate arrays of their AC and GT words
+			twoBitTargets = std::all_of(targets.begin(),targets.end(),[&](const DNA4 &t){return twoBitComparison.canPack(t);});
+			if(twoBitTargets)
+			{
+				packedTargets.reserve(targets.size());
+				for(const DNA4 &t: targets)
+				{
+					packedTargets.push_back(t.toTwoBits());
+				}
+			}
+		}
+		if(!targetContainer && !twoBitTargets)
+		{
+			targetACs.reserve(targets.size());
+			targetGTs.reserve(targets.size());
+			for(const DNA4 &t: targets)
+			{
+				targetACs.push_back(t[0]);
+				targetGTs.push_back(t[1]);
+			}
+		}
+		minSimilarity = DNA4::getLength() -  mismatches;
+		if(DNA4::getLength() < mismatches) minSimilarity = 0;//avoid underflow
+
+		if(targetContainer)
+		{
+			std::cout << "using index method" << std::endl;
+		}
+		else
+		{
+			std::cout << "Using simple method"<< std::endl;
+		}
+		searchBuffers = makeSearchBuffers();
+	}
+
+	public:
+	//passes the matches of every search to sink instead of storing them, nullptr stores them again
+	//sink must outlive the searches and flushResults must be called once searching is done, in countOnly mode there is no sink
+	void setResultSink(ResultSink *sink)
+	{
+		flushResults();
+		resultSink = sink;
+	}
+
+	//passes any matches that are waiting to fill a block to the result sink and flushes it
+	//the multithreaded searches do this when they finish
+	void flushResults()
+	{
+		if(resultSink)
+		{
+			sendToSink();
+			resultSink->flush();
+		}
+	}
+
+	//seq is read from strand, for the reverse strand it should be the reverse complement
+	void findMatches(DNA4 & seq, size_t position, uint32_t seqID, Strand strand = Strand::forward)
+	{
+		if(countOnly)
+		{
+			CountMatches matches{offTargetCounts.data(),distances};
+			findMatches(seq, Position{seqID,uint32_t(position),strand}, searchBuffers, matches);
+		}
+		else if(resultSink)
+		{
+			CollectMatches matches{sinkMatches};
+			findMatches(seq, Position{seqID,uint32_t(position),strand}, searchBuffers, matches);
+			if(sinkMatches.size() >= sinkBlockSize)
+			{
+				sendToSink();
+			}
+		}
+		else
+		{
+			AddToOffTargets matches{offTargetContainers()};
+			findMatches(seq, Position{seqID,uint32_t(position),strand}, searchBuffers, matches);
+		}
+	}
+
+	//the number of sequences FindIfOffTargetInBatches and the multithreaded search pass to findMatches at once
+	static constexpr uint32_t batchSize = 1<<14;
+	//the number of targets in each chunk of the multithreaded search, chunks need to hold several batches
+	//of targets that pass the filter for the batches to be worthwhile
+	static constexpr size_t defaultChunkSize = 1<<20;
+
+	//searches for numSeqs sequences at once, seqs[i] is at positions[i]
+	//the index is probed with all of them together so each bucket only has to be read once for all the sequences that hash to it
+	//the off targets found are the same as calling findMatches for each sequence in turn
+	void findMatches(const DNA4 *seqs, const Position *positions, uint32_t numSeqs)
+	{
+		if(countOnly)
+		{
+			CountMatches matches{offTargetCounts.data(),distances};
+			findMatches(seqs, positions, numSeqs, searchBuffers, matches);
+		}
+		else if(resultSink)
+		{
+			CollectMatches matches{sinkMatches};
+			findMatches(seqs, positions, numSeqs, searchBuffers, matches);
+			if(sinkMatches.size() >= sinkBlockSize)
+			{
+				sendToSink();
+			}
+		}
+		else
+		{
+			AddToOffTargets matches{offTargetContainers()};
+			findMatches(seqs, positions, numSeqs, searchBuffers, matches);
+		}
+	}
+
+	//searches every target in the first length characters of sequence using numThreads threads (0 uses all available cores)
+	//the sequence is split into chunks of chunkSize targets which overlap by DNA4::getLength()-1 characters
+	//the off targets found are identical to doForTargetsInSequence(sequence,filter,FindIfOffTarget(*this,seqID))
+	//or doForTargetsOnBothStrands if bothStrands is set
+	void findMatchesInSequence(const char * sequence, size_t length, Filter filter, uint32_t seqID, uint32_t numThreads = 0, size_t chunkSize = defaultChunkSize, bool bothStrands = false)
+	{
+		if(length < DNA4::getLength())
+			return;
+		size_t numWindows = length-DNA4::getLength()+1;
+		size_t numChunks = (numWindows+chunkSize-1)/chunkSize;
+		findMatchesInChunks(numChunks,numThreads,[&](size_t chunk, auto &action)
+		{
+			size_t begin = chunk*chunkSize;
+			size_t end = std::min(begin+chunkSize,numWindows);
+			action.sequenceID = seqID;
+			if(bothStrands)
+			{
+				doForTargetsOnBothStrands(sequence,begin,end,filter,action);
+			}
+			else
+			{
+				doForTargetsInSequence(sequence,begin,end,filter,action);
+			}
+		});
+	}
+
+	//searches numChunks chunks of sequence using numThreads threads (0 uses all available cores)
+	//scanChunk(chunk,action) must set action.sequenceID and do action for every target in the chunk
+	//the matches of each chunk are added to the off targets in chunk order, or counted straight away in countOnly mode
+	template<class ScanChunk>
+	void findMatchesInChunks(size_t numChunks, uint32_t numThreads, ScanChunk &&scanChunk)
+	{
+		if(targets.size()==0)
+			return;
+		numThreads = numberOfThreadsToUse(numThreads,numChunks);
+		std::vector<std::vector<Match> > matchesInChunk(countOnly ? 0 : numChunks);
+		std::vector<SearchBuffers> buffers;
+		for(uint32_t i = 0; i < numThreads; ++i)
+		{
+			buffers.push_back(makeSearchBuffers());
+		}
+		//chunks are merged in the order they appear in the sequence so the off targets are in the same order as a single threaded search
+		//each chunk is merged as soon as the chunks before it have been, so only the chunks being searched are held in memory
+		std::mutex mergeLock;
+		std::vector<bool> chunkSearched(matchesInChunk.size(),false);
+		size_t nextChunkToMerge = 0;
+		sendToSink();
+		runInParallel(numChunks,numThreads,[&](size_t chunk, uint32_t thread)
+		{
+			TraceScope trace("search chunk");
+			if(countOnly)
+			{
+				CountMatches matches{offTargetCounts.data(),distances};
+				FindInChunk<CountMatches> findInChunk{*this,buffers[thread],matches,0};
+				scanChunk(chunk,findInChunk);
+				findInChunk.flush();
+				return;
+			}
+			CollectMatches matches{matchesInChunk[chunk]};
+			FindInChunk<CollectMatches> findInChunk{*this,buffers[thread],matches,0};
+			scanChunk(chunk,findInChunk);
+			findInChunk.flush();
+			std::lock_guard<std::mutex> lock(mergeLock);
+			TraceScope mergeTrace("merge matches");
+			chunkSearched[chunk] = true;
+			for(; nextChunkToMerge < numChunks && chunkSearched[nextChunkToMerge]; ++nextChunkToMerge)
+			{
+				mergeMatches(matchesInChunk[nextChunkToMerge]);
+				std::vector<Match>().swap(matchesInChunk[nextChunkToMerge]);
+			}
+		});
+		flushResults();
+	}
+
+	//there are no off target containers in countOnly mode
+	std::vector<OffTargetContainer> & getOffTargets()
+	{
+		return offTargetContainers();
+	}
+
+	//the number of matches the result sink is sent at once, apart from the last block before it is flushed
+	static constexpr size_t sinkBlockSize = 1<<12;
+
+	private:
+	//the off target containers are only created when matches are first stored in them, so searches
+	//that count their matches or send them to a result sink never allocate them
+	std::vector<OffTargetContainer> &offTargetContainers()
+	{
+		if(offTargets.empty() && !countOnly)
+		{
+			offTargets.reserve(originalTargets.size());
+			for(const DNA4 &t: originalTargets)
+			{
+				offTargets.emplace_back(t,distances-1);
+			}
+		}
+		return offTargets;
+	}
+
+	void mergeMatches(const std::vector<Match> &matches)
+	{
+		if(resultSink)
+		{
+			if(matches.size())
+				resultSink->addMatches(matches.data(),matches.size());
+			return;
+		}
+		std::vector<OffTargetContainer> &containers = offTargetContainers();
+		for(const Match &m: matches)
+		{
+			containers[m.targetIndex][m.mismatches].push_back(m.offTarget);
+		}
+	}
+
+	void sendToSink()
+	{
+		if(resultSink && sinkMatches.size())
+		{
+			resultSink->addMatches(sinkMatches.data(),sinkMatches.size());
+			sinkMatches.clear();
+		}
+	}
+
+	//a match found while probing the index with a batch of sequences
+	struct BatchMatch
+	{
+		uint32_t seqInBatch;
+		uint32_t targetIndex;
+		uint32_t mismatches;
+		bool operator<(const BatchMatch &o) const
+		{
+			return seqInBatch!=o.seqInBatch ? seqInBatch<o.seqInBatch : targetIndex<o.targetIndex;
+		}
+	};
+
+	//scratch space used when searching, every thread searching at the same time needs its own
+	struct SearchBuffers
+	{
+		std::vector<TargetBucket> buckets;
+		std::vector<uint32_t> bucketsForHash;
+		//bucket in the high 32 bits and the sequence in the batch in the low 32 bits
+		std::vector<uint64_t> batchProbes;
+		std::vector<DNA4> batchSeqs;
+		std::vector<Position> batchPositions;
+		//the sequences of the batch prepared for comparing with packed targets, those that could not be have twoBitSeqIsExact[s] of 0
+		std::vector<TwoBitSequence> batchTwoBitSeqs;
+		std::vector<uint8_t> twoBitSeqIsExact;
+		std::vector<BatchMatch> batchMatches;
+		std::vector<uint32_t> matchedTargets;
+		std::vector<uint8_t> similarities;
+	};
+
+	//the matches of a search are passed to addMatch(targetIndex,mismatches,seq,position) of one of these
+	//each target is passed at most once for each sequence searched for, without looking at the matches already passed
+
+	//adds matches straight to the off target containers
+	struct AddToOffTargets
+	{
+		std::vector<OffTargetContainer> &offTargets;
+		void addMatch(uint32_t targetIndex, uint32_t mismatches, const DNA4 &seq, const Position &position)
+		{
+			offTargets[targetIndex][mismatches].push_back(OffTarget{position,seq});
+		}
+	};
+
+	//stores matches in the order they are found so they can be merged into the off target containers later
+	struct CollectMatches
+	{
+		std::vector<Match> &matches;
+		void addMatch(uint32_t targetIndex, uint32_t mismatches, const DNA4 &seq, const Position &position)
+		{
+			matches.push_back(Match{targetIndex,mismatches,OffTarget{position,seq}});
+		}
+	};
+
+	//counts the matches of each target at each distance without storing them
+	//several threads can count into the same counts at once
+	struct CountMatches
+	{
+		uint64_t *counts;
+		uint32_t distances;
+		void addMatch(uint32_t targetIndex, uint32_t mismatches, const DNA4 &, const Position &)
+		{
+			__atomic_fetch_add(&counts[uint64_t(targetIndex)*distances+mismatches],1,__ATOMIC_RELAXED);
+		}
+	};
+
+	//searches for the targets of a chunk in batches, flush must be called at the end of the chunk
+	template<class Matches>
+	struct FindInChunk
+	{
+		const OffTargetFinder &offTargetFinder;
+		SearchBuffers &buffers;
+		Matches &matches;
+		uint32_t sequenceID;
+		void doAction(DNA4 &t,uint32_t position,Strand strand = Strand::forward)
+		{
+			buffers.batchSeqs.push_back(t);
+			buffers.batchPositions.push_back(Position{sequenceID,position,strand});
+			if(buffers.batchSeqs.size()==batchSize)
+			{
+				flush();
+			}
+		}
+		void flush()
+		{
+			offTargetFinder.findMatches(buffers.batchSeqs.data(),buffers.batchPositions.data(),buffers.batchSeqs.size(),buffers,matches);
+			buffers.batchSeqs.clear();
+			buffers.batchPositions.clear();
+		}
+	};
+
+	SearchBuffers makeSearchBuffers() const
+	{
+		SearchBuffers buffers;
+		if(targetContainer)
+		{
+			buffers.buckets.resize(targetContainer.numberOfHashmaps());
+			buffers.bucketsForHash.resize(targetContainer.numberOfHashmaps());
+		}
+		else
+		{
+			buffers.matchedTargets.resize(targets.size());
+			buffers.similarities.resize(targets.size());
+		}
+		return buffers;
+	}
+
+	template<class Matches>
+	void findMatches(const DNA4 & seq, const Position &position, SearchBuffers &buffers, Matches &matches) const
+	{
+		if(targetContainer)
+		{
+			findMatchesWithIndex(seq, position, buffers, matches);
+		}
+		else
+		{
+			findMatchesSimple(seq, position, buffers, matches);
+		}
+	}
+
+	template<class Matches>
+	void findMatches(const DNA4 *seqs, const Position *positions, uint32_t numSeqs, SearchBuffers &buffers, Matches &matches) const
+	{
+		if(targetContainer)
+		{
+			findMatchesWithIndex(seqs, positions, numSeqs, buffers, matches);
+		}
+		else
+		{
+			for(uint32_t i = 0; i < numSeqs; ++i)
+			{
+				findMatchesSimple(seqs[i], positions[i], buffers, matches);
+			}
+		}
+	}
+
+	template<class Matches>
+	void findMatchesWithIndex(const DNA4 *seqs, const Position *positions, uint32_t numSeqs, SearchBuffers &buffers, Matches &matches) const
+	{
+		TraceScope trace("hash batch");
+		uint32_t numHashmaps = targetContainer.numberOfHashmaps();
+		COUNT_SEARCH_STATS(stats.indexSearches += numSeqs; stats.bucketsProbed += uint64_t(numSeqs)*numHashmaps);
+		std::vector<uint64_t> &probes = buffers.batchProbes;
+		probes.resize(uint64_t(numSeqs)*numHashmaps);
+		std::vector<TwoBitSequence> &twoBitSeqs = buffers.batchTwoBitSeqs;
+		std::vector<uint8_t> &twoBitSeqIsExact = buffers.twoBitSeqIsExact;
+		if(twoBitTargets)
+		{
+			twoBitSeqs.resize(numSeqs);
+			twoBitSeqIsExact.resize(numSeqs);
+		}
+		for(uint32_t s = 0; s < numSeqs; ++s)
+		{
+			if(twoBitTargets)
+			{
+				twoBitSeqIsExact[s] = twoBitComparison.prepare(seqs[s],twoBitSeqs[s]);
+			}
+			uint32_t *bucketsForHash = buffers.bucketsForHash.data();
+			targetContainer.hash(seqs[s],bucketsForHash);
+			for(uint32_t j = 0; j < numHashmaps; ++j)
+			{
+				probes[uint64_t(s)*numHashmaps+j] = uint64_t(bucketsForHash[j]) << 32 | s;
+			}
+		}
+		//group the sequences by the bucket they probe
+		std::sort(probes.begin(),probes.end());
+		trace.next("verify batch");
+		std::vector<BatchMatch> &batchMatches = buffers.batchMatches;
+		batchMatches.clear();
+		const bool hasSplitBuckets = targetContainer.hasSplitBuckets();
+		for(size_t first = 0; first < probes.size();)
+		{
+			uint32_t bucketNum = probes[first] >> 32;
+			size_t last = first+1;
+			while(last < probes.size() && uint32_t(probes[last] >> 32)==bucketNum)
+			{
+				last++;
+			}
+			size_t groupEnd = last;
+			uint32_t hashmap = targetContainer.hashmapOfBucket(bucketNum);
+			TargetBucket bucket = targetContainer.getBucket(bucketNum,hashmap);
+			const SplitBucket *split = hasSplitBuckets ? targetContainer.splitBucket(bucketNum,bucket.size) : nullptr;
+			if(split)
+			{
+				//the sequences that can be looked for in the parts of the split bucket are moved to the end of the group,
+				//those that cannot are compared with the whole bucket below
+				size_t middle = last;
+				for(size_t probe = last; probe-- > first;)
+				{
+					uint32_t s = uint32_t(probes[probe]);
+					TwoBitSequence twoBitSeq;
+					bool exact = twoBitTargets ? twoBitSeqIsExact[s] : twoBitComparison.prepare(seqs[s],twoBitSeq);
+					if(!exact)
+						continue;
+					compareWithSplitBucket(BucketProbe{seqs[s],twoBitTargets ? &twoBitSeqs[s] : &twoBitSeq,true},hashmap,*split,[&](uint32_t targetIndex, uint32_t mismatches)
+					{
+						batchMatches.push_back(BatchMatch{s,targetIndex,mismatches});
+					});
+					std::swap(probes[probe],probes[--middle]);
+				}
+				last = middle;
+			}
+			COUNT_SEARCH_STATS(stats.candidatesVerified += bucket.size*(last-first));
+			for(uint32_t targetNum = 0; targetNum<bucket.size && twoBitTargets; targetNum++)
+			{
+				uint64_t target = bucket.begin_twoBit[targetNum];
+				for(size_t probe = first; probe < last; ++probe)
+				{
+					uint32_t s = uint32_t(probes[probe]);
+					verifyTarget(BucketProbe{seqs[s],&twoBitSeqs[s],bool(twoBitSeqIsExact[s])},target,bucket.begin_position[targetNum],hashmap,nullptr,0,[&](uint32_t targetIndex, uint32_t mismatches)
+					{
+						batchMatches.push_back(BatchMatch{s,targetIndex,mismatches});
+					});
+				}
+			}
+			for(uint32_t targetNum = 0; targetNum<bucket.size && !twoBitTargets; targetNum++)
+			{
+				const DNA4 &target = bucket.begin_DNA[targetNum];
+				for(size_t probe = first; probe < last; ++probe)
+				{
+					uint32_t s = uint32_t(probes[probe]);
+					verifyTarget(BucketProbe{seqs[s],nullptr,false},target,bucket.begin_position[targetNum],hashmap,nullptr,0,[&](uint32_t targetIndex, uint32_t mismatches)
+					{
+						batchMatches.push_back(BatchMatch{s,targetIndex,mismatches});
+					});
+				}
+			}
+			first = groupEnd;
+		}
+		//put the matches back in the order of the sequences
+		trace.next("collect batch matches");
+		std::sort(batchMatches.begin(),batchMatches.end());
+		for(const BatchMatch &m: batchMatches)
+		{
+			COUNT_SEARCH_STATS(stats.hitsAtDistance[m.mismatches]++);
+			matches.addMatch(m.targetIndex,m.mismatches,seqs[m.seqInBatch],positions[m.seqInBatch]);
+		}
+	}
+
+	template<class Matches>
+	void findMatchesWithIndex(const DNA4 & seq, const Position &position, SearchBuffers &buffers, Matches &matches) const
+	{
+		//naiveComparisons += targetContainer.numberOfTargets();
+		TargetBucket *bucketsArray = buffers.buckets.data();
+		targetContainer.getBuckets(seq,bucketsArray,buffers.bucketsForHash.data());
+		COUNT_SEARCH_STATS(stats.indexSearches++; stats.bucketsProbed += targetContainer.numberOfHashmaps());
+		//only a sequence whose characters are each one base or none can be compared with packed targets in the packed form
+		//or looked for in the parts of a split bucket
+		TwoBitSequence twoBitSeq;
+		bool prepared = twoBitTargets || targetContainer.hasSplitBuckets();
+		bool exact = prepared && twoBitComparison.prepare(seq,twoBitSeq);
+		BucketProbe probe{seq,prepared ? &twoBitSeq : nullptr,exact};
+		auto found = [&](uint32_t targetIndex, uint32_t mismatches)
+		{
+			COUNT_SEARCH_STATS(stats.hitsAtDistance[mismatches]++);
+			matches.addMatch(targetIndex,mismatches,seq,position);
+		};
+		for(uint32_t i = 0; i < targetContainer.numberOfHashmaps(); ++i)
+		{
+			TargetBucket bucket = bucketsArray[i];
+			const SplitBucket *split = exact ? targetContainer.splitBucket(buffers.bucketsForHash[i],bucket.size) : nullptr;
+			if(split)
+				compareWithSplitBucket(probe,i,*split,found);
+			else
+				verifyBucket(probe,bucket,i,nullptr,0,found);
+		}
+	}
+
+	//a sequence being compared with the targets of the buckets it probes, twoBitSeq is it prepared by twoBitComparison,
+	//which returned exact, or nullptr if it was not prepared
+	struct BucketProbe
+	{
+		const DNA4 &seq;
+		const TwoBitSequence *twoBitSeq;
+		bool exact;
+
+		//the characters the index hashes
+		uint64_t characters() const
+		{
+			return twoBitSeq ? twoBitSeq->characters : TargetContainer::hashCharacters(seq);
+		}
+	};
+
+	uint32_t similarityTo(const BucketProbe &probe, const DNA4 &target, uint32_t) const
+	{
+		return probe.seq.getSimilarity(target);
+	}
+
+	//a sequence with a compared character that could be more than one base is compared with the DNA4 of the packed target
+	uint32_t similarityTo(const BucketProbe &probe, uint64_t target, uint32_t targetIndex) const
+	{
+		return probe.exact ? probe.twoBitSeq->similarity(target) : probe.seq.getSimilarity(targets[targetIndex]);
+	}
+
+	static uint64_t charactersOf(const DNA4 &target)
+	{
+		return TargetContainer::hashCharacters(target);
+	}
+
+	static uint64_t charactersOf(uint64_t target)
+	{
+		return target;
+	}
+
+	//compares probe with target, a DNA4 or packed target of the bucket it probed in hashmap, or in part of split if the bucket is
+	//one of its parts, and calls found(targetIndex,mismatches) if they match and the match is not also found from an earlier
+	//hashmap or part, so that every match is reported once
+	template<class Target, class Found>
+	void verifyTarget(BucketProbe probe, const Target &target, uint32_t targetIndex, uint32_t hashmap, const SplitBucket *split, uint32_t part, Found &&found) const
+	{
+		uint32_t similarity = similarityTo(probe,target,targetIndex);
+		if(similarity<minSimilarity)
+			return;
+		uint64_t seqCharacters = probe.characters();
+		uint64_t targetCharacters = charactersOf(target);
+		if((split && targetContainer.foundInEarlierPart(seqCharacters,targetCharacters,*split,part)) ||
+		   targetContainer.foundInEarlierHashmap(seqCharacters,targetCharacters,hashmap))
+		{
+			COUNT_SEARCH_STATS(stats.duplicatesSuppressed++);
+			return;
+		}
+		found(targetIndex,DNA4::getLength()-similarity);
+	}
+
+	//verifyTarget for every target of bucket
+	template<class Found>
+	void verifyBucket(BucketProbe probe, const TargetBucket &bucket, uint32_t hashmap, const SplitBucket *split, uint32_t part, Found &&found) const
+	{
+		COUNT_SEARCH_STATS(stats.candidatesVerified += bucket.size);
+		for(uint32_t targetNum = 0; targetNum<bucket.size && twoBitTargets; targetNum++)
+		{
+			verifyTarget(probe,bucket.begin_twoBit[targetNum],bucket.begin_position[targetNum],hashmap,split,part,found);
+		}
+		for(uint32_t targetNum = 0; targetNum<bucket.size && !twoBitTargets; targetNum++)
+		{
+			verifyTarget(probe,bucket.begin_DNA[targetNum],bucket.begin_position[targetNum],hashmap,split,part,found);
+		}
+	}
+
+	//compares probe with the sub bucket it probes in each part of split, which it probed in hashmap, probe must be exact, as a sequence
+	//with characters that could be more than one base could match a target in a part without being the same
+	template<class Found>
+	void compareWithSplitBucket(BucketProbe probe, uint32_t hashmap, const SplitBucket &split, Found &&found) const
+	{
+		for(uint32_t part = 0; part < split.parts; ++part)
+		{
+			verifyBucket(probe,targetContainer.getSubBucket(split,part,probe.twoBitSeq->characters),hashmap,&split,part,found);
+		}
+	}
+
+	template<class Matches>
+	void findMatchesSimple(const DNA4 & seq, const Position &position, SearchBuffers &buffers, Matches &matches) const
+	{
+		//compare all the targets with this sequence
+		uint32_t numberOfMatches;
+		TwoBitSequence twoBitSeq;
+		COUNT_SEARCH_STATS(stats.simpleSearches++; stats.candidatesVerified += targets.size());
+		if(!twoBitTargets)
+		{
+			numberOfMatches = compareTargets(targetACs.data(),targetGTs.data(),targets.size(),seq,minSimilarity,
+											buffers.matchedTargets.data(),buffers.similarities.data());
+		}
+		else if(twoBitComparison.prepare(seq,twoBitSeq))
+		{
+			numberOfMatches = compareTwoBitTargets(packedTargets.data(),targets.size(),twoBitSeq,minSimilarity,
+												buffers.matchedTargets.data(),buffers.similarities.data());
+		}
+		else
+		{
+			//a sequence with characters that could be more than one base is compared as a DNA4
+			numberOfMatches = 0;
+			for(uint32_t t = 0; t < targets.size(); ++t)
+			{
+				uint32_t similarity = seq.getSimilarity(targets[t]);
+				if(similarity>=minSimilarity)
+				{
+					buffers.matchedTargets[numberOfMatches] = t;
+					buffers.similarities[numberOfMatches] = similarity;
+					numberOfMatches++;
+				}
+			}
+		}
+		for(uint32_t i = 0; i < numberOfMatches;++i)
+		{
+			uint32_t mismatch = DNA4::getLength()-buffers.similarities[i];
+			COUNT_SEARCH_STATS(stats.hitsAtDistance[mismatch]++);
+			matches.addMatch(buffers.matchedTargets[i],mismatch,seq,position);
+		}
+	}
+
+	std::vector<OffTargetContainer> offTargets;
+	TargetContainer targetContainer;
+	std::vector<DNA4> targets;
+	std::vector<uint64_t> targetACs;
+	std::vector<uint64_t> targetGTs;
+	CompareTargetsKernel compareTargets;
+	//if every target could be packed they are compared in the packed form, in packedTargets for the simple method
+	bool twoBitTargets;
+	std::vector<uint64_t> packedTargets;
+	TwoBitComparison twoBitComparison;
+	CompareTwoBitTargetsKernel compareTwoBitTargets;
+	SearchBuffers searchBuffers;
+	uint_fast8_t minSimilarity;
+	bool countOnly;
+	ResultSink *resultSink;
+	//matches of the single threaded searches waiting to be sent to the result sink
+	std::vector<Match> sinkMatches;
+	//the number of distances a match can be, mismatches+1
+	uint32_t distances;
+	//the targets without the filter characters
+	std::vector<DNA4> originalTargets;
+	//in countOnly mode the number of off targets of target t at distance d is at offTargetCounts[t*distances+d]
+	std::vector<uint64_t> offTargetCounts;
+};
+
+struct FindIfOffTarget{
+	OffTargetFinder &offTargetFinder;
+	uint32_t sequenceID;
+	FindIfOffTarget(OffTargetFinder &offTargetFinder,uint32_t sequenceID)
+	:offTargetFinder(offTargetFinder),sequenceID(sequenceID)
+	{}
+	void doAction(DNA4 &t,uint32_t position,Strand strand = Strand::forward)
+	{
+		offTargetFinder.findMatches(t,position,sequenceID,strand);
+	}
+};
+
+//collects targets and searches for batchSize of them at a time with OffTargetFinder::findMatches
+//the remaining targets are searched for by flush, which is called when this is destroyed
+struct FindIfOffTargetInBatches{
+	OffTargetFinder &offTargetFinder;
+	uint32_t sequenceID;
+	uint32_t batchSize;
+	std::vector<DNA4> seqs;
+	std::vector<OffTargetFinder::Position> positions;
+	FindIfOffTargetInBatches(OffTargetFinder &offTargetFinder,uint32_t sequenceID,uint32_t batchSize = OffTargetFinder::batchSize)
+	:offTargetFinder(offTargetFinder),sequenceID(sequenceID),batchSize(batchSize)
+	{
+		seqs.reserve(batchSize);
+		positions.reserve(batchSize);
+	}
+	FindIfOffTargetInBatches(const FindIfOffTargetInBatches&) = delete;
+	FindIfOffTargetInBatches(FindIfOffTargetInBatches&&) = default;
+	~FindIfOffTargetInBatches()
+	{
+		flush();
+	}
+	void doAction(DNA4 &t,uint32_t position,Strand strand = Strand::forward)
+	{
+		seqs.push_back(t);
+		positions.push_back(OffTargetFinder::Position{sequenceID,position,strand});
+		if(seqs.size()==batchSize)
+		{
+			flush();
+		}
+	}
+	void flush()
+	{
+		if(seqs.size())
+		{
+			offTargetFinder.findMatches(seqs.data(),positions.data(),seqs.size());
+		}
+		seqs.clear();
+		positions.clear();
+	}
+};
+
+//the set actions work on a DNA4Set or a ConcurrentDNA4Set, only a ConcurrentDNA4Set can be used by the multithreaded scans
+template<class Set>
+struct AddToSet{
+	Set &s;
+	AddToSet(Set & set)
+	:s(set){}
+	void doAction(DNA4 &t,uint32_t,Strand = Strand::forward){s.insert(t);}
+};
+
+template<class Set>
+struct RemoveFromSet{
+	Set &s;
+	RemoveFromSet(Set & set)
+	:s(set){}
+	void doAction(DNA4 &t,uint32_t,Strand = Strand::forward){s.remove(t);}
+};
+
+template<class Set, class OtherSet>
+struct AddToSetIfExistingInOtherSet{
+	Set &s;
+	OtherSet &otherSet;
+	AddToSetIfExistingInOtherSet(Set &set, OtherSet &otherSet)
+	:s(set),otherSet(otherSet){}
+	void doAction(DNA4 &t,uint32_t,Strand = Strand::forward)
+	{
+		if(otherSet.contains(t))
+			s.insert(t);
+	}
+};
+
+//the actions that every thread of a multithreaded scan can use at the same time, the set actions on a ConcurrentDNA4Set
+//the other set of AddToSetIfExistingInOtherSet is only read, so it can be either kind of set while nothing changes it
+template<class Action>
+struct isConcurrentAction : std::false_type {};
+
+template<>
+struct isConcurrentAction<AddToSet<ConcurrentDNA4Set> > : std::true_type {};
+
+template<>
+struct isConcurrentAction<RemoveFromSet<ConcurrentDNA4Set> > : std::true_type {};
+
+template<class OtherSet>
+struct isConcurrentAction<AddToSetIfExistingInOtherSet<ConcurrentDNA4Set,OtherSet> > : std::true_type {};
+
+//calls function(std::integral_constant<uint32_t,Length>()) with the target length as Length when it is one of the usual lengths
+//and 0 otherwise, so the scan loops are instantiated for each usual length with the masks and shifts folded into constants
+template<class Function>
+void withTargetLength(Function &&function)
+{
+	switch(DNA4::getLength())
+	{
+		case 20: function(std::integral_constant<uint32_t,20>()); break;
+		case 21: function(std::integral_constant<uint32_t,21>()); break;
+		case 22: function(std::integral_constant<uint32_t,22>()); break;
+		case 23: function(std::integral_constant<uint32_t,23>()); break;
+		case 24: function(std::integral_constant<uint32_t,24>()); break;
+		case 25: function(std::integral_constant<uint32_t,25>()); break;
+		case 32: function(std::integral_constant<uint32_t,32>()); break;
+		default: function(std::integral_constant<uint32_t,0>()); break;
+	}
+}
+
+//the first character from begin to end-1 that is a base if base is true, or that is not a base if it is false, end if there is none
+//compares a vector of characters at a time, so long runs of N can be jumped over
+const char *findCharacter(const char *begin, const char *end, bool base)
+{
+#if defined(__AVX2__)
+	const __m256i lowerCase = _mm256_set1_epi8(0x20);
+	for(; end-begin >= 32; begin += 32)
+	{
+		__m256i c = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin)),lowerCase);
+		__m256i bases = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c,_mm256_set1_epi8('a')),_mm256_cmpeq_epi8(c,_mm256_set1_epi8('c'))),
+										_mm256_or_si256(_mm256_cmpeq_epi8(c,_mm256_set1_epi8('g')),_mm256_cmpeq_epi8(c,_mm256_set1_epi8('t'))));
+		uint32_t found = uint32_t(_mm256_movemask_epi8(bases)) ^ (base ? 0 : ~0U);
+		if(found)
+			return begin+__builtin_ctz(found);
+	}
+#elif defined(__SSE2__)
+	const __m128i lowerCase = _mm_set1_epi8(0x20);
+	for(; end-begin >= 16; begin += 16)
+	{
+		__m128i c = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(begin)),lowerCase);
+		__m128i bases = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c,_mm_set1_epi8('a')),_mm_cmpeq_epi8(c,_mm_set1_epi8('c'))),
+									 _mm_or_si128(_mm_cmpeq_epi8(c,_mm_set1_epi8('g')),_mm_cmpeq_epi8(c,_mm_set1_epi8('t'))));
+		uint32_t found = uint32_t(_mm_movemask_epi8(bases)) ^ (base ? 0 : 0xFFFF);
+		if(found)
+			return begin+__builtin_ctz(found);
+	}
+#endif
+	while(begin < end && isBase(*begin)!=base)
+	{
+		++begin;
+	}
+	return begin;
+}
+
+//calls scan(first,last) for each range of the windows from begin to end-1 of sequence whose length characters are all bases,
+//or once for every window if filter keeps ambiguous windows, sequence must contain at least end+length-1 characters
+template<class Scan>
+void forWindowsToScan(const char * sequence, size_t begin, size_t end, uint32_t length, const Filter &filter, Scan &&scan)
+{
+	if(filter.keepsAmbiguousWindows())
+	{
+		scan(begin,end);
+		return;
+	}
+	//the characters are searched a block at a time, so they are still in the cache when they are scanned
+	const size_t blockSize = 1 << 14;
+	const char *sequenceEnd = sequence+end+length-1;
+	for(const char *c = sequence+begin; c < sequenceEnd;)
+	{
+		const char *blockEnd = size_t(sequenceEnd-c) > blockSize ? c+blockSize : sequenceEnd;
+		const char *ambiguous = findCharacter(c,blockEnd,false);
+		//the windows that end before the ambiguous character or the end of the block
+		if(size_t(ambiguous-c) >= length)
 		{
-			std::vector<Position> p;
-			for(OffTarget &ot:offtargets[0])
-			{
-				if(ot.exactMatchTo(target))
-				{
-					p.push_back(ot.position);
-				}
-			}
-			return p;
+			scan(c-sequence,ambiguous-sequence-length+1);
 		}
+		if(ambiguous==blockEnd && blockEnd < sequenceEnd)
+			c = ambiguous-length+1;
+		else
+			c = findCharacter(ambiguous,sequenceEnd,true);
+	}
+}
 
-	};
+//sets masks to where each base is in the 64 characters from s, in either case, the masks are for A, C, G and T
+//and the first character is the most significant bit, as in a DNA4, characters past available are no base
+void findBases(const char *s, size_t available, uint64_t masks[4])
+{
+	char padded[64];
+	if(available < 64)
+	{
+		memset(padded,0,sizeof(padded));
+		memcpy(padded,s,available);
+		s = padded;
+	}
+#if defined(__AVX2__)
+	//reverses the characters so the first one is in the most significant bit of the movemask
+	const __m256i reverse = _mm256_setr_epi8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+	const __m256i lowerCase = _mm256_set1_epi8(0x20);
+	__m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+	__m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s+32));
+	first = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_permute4x64_epi64(first,0x4E),reverse),lowerCase);
+	second = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_permute4x64_epi64(second,0x4E),reverse),lowerCase);
+	const char bases[4] = {'a','c','g','t'};
+	for(uint32_t i = 0; i < 4; ++i)
+	{
+		__m256i base = _mm256_set1_epi8(bases[i]);
+		masks[i] = uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(first,base)))) << 32 |
+				   uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(second,base)));
+	}
+#elif defined(__SSE2__)
+	//without a byte shuffle the movemasks have the first character in the least significant bit, so they are reversed after
+	const __m128i lowerCase = _mm_set1_epi8(0x20);
+	__m128i c[4];
+	for(uint32_t i = 0; i < 4; ++i)
+	{
+		c[i] = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s+16*i)),lowerCase);
+	}
+	const char bases[4] = {'a','c','g','t'};
+	for(uint32_t i = 0; i < 4; ++i)
+	{
+		__m128i base = _mm_set1_epi8(bases[i]);
+		uint32_t first = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(c[0],base))) | uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(c[1],base))) << 16;
+		uint32_t second = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(c[2],base))) | uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(c[3],base))) << 16;
+		masks[i] = uint64_t(reverseBits(first)) << 32 | reverseBits(second);
+	}
+#else
+	uint64_t ac = 0;
+	uint64_t gt = 0;
+	for(uint32_t i = 0; i < 32; ++i)
+	{
+		unsigned char c = s[i];
+		ac = ac << 1 | acs[c];
+		gt = gt << 1 | gts[c];
+	}
+	masks[0] = ac & 0xFFFFFFFF00000000ULL;
+	masks[1] = ac << 32;
+	masks[2] = gt & 0xFFFFFFFF00000000ULL;
+	masks[3] = gt << 32;
+	ac = 0;
+	gt = 0;
+	for(uint32_t i = 32; i < 64; ++i)
+	{
+		unsigned char c = s[i];
+		ac = ac << 1 | acs[c];
+		gt = gt << 1 | gts[c];
+	}
+	masks[0] |= ac >> 32;
+	masks[1] |= uint32_t(ac);
+	masks[2] |= gt >> 32;
+	masks[3] |= uint32_t(gt);
+#endif
+}
 
-	OffTargetFinder(const std::vector<DNA4> &targets, uint_fast8_t mismatches, Filter filter, uint64_t maxIndexSize = ~0ULL)
-	:	targetContainer(mismatches,filter),
-		targets(targets),
-		matched1(nullptr),matched2(nullptr),
-		bucketsArray(nullptr)
+//finds the windows that pass a filter from the characters of a sequence, 32 windows at a time, so only those windows are built
+//a window passes when the character in each filter position is one of the bases allowed there, which is what Filter::passes checks
+class WindowPrefilter
+{
+	public:
+	//filter is the DNA4 of the filter, or its reverse complement to find the windows whose reverse complement passes
+	WindowPrefilter(const DNA4 &filter, uint32_t length)
+	:numSets(0)
 	{
-		if(targets.size()==0)
-		{
-			return;
-		}
-		offTargets.reserve(targets.size());
-		for(uint32_t i = 0; i < targets.size();i++)
-		{
-			offTargets.emplace_back(targets[i],mismatches);
-		}
-		if(filter.exists())
+		//the filter positions are grouped by the bases allowed in them, so each group's characters are found once a block
+		for(uint32_t position = 0; position < length; ++position)
 		{
-			for(DNA4 &t: this->targets)
+			uint32_t bit = length-1-position;
+			uint32_t allowed = (filter[0]>>(32+bit)&1) | (filter[0]>>bit&1) << 1 | (filter[1]>>(32+bit)&1) << 2 | (filter[1]>>bit&1) << 3;
+			if(!allowed)
+				continue;
+			uint32_t set = 0;
+			while(set < numSets && bases[set]!=allowed)
 			{
-				filter.addFilterCharsToTarget(t);
+				++set;
+			}
+			if(set==numSets)
+			{
+				bases[numSets] = allowed;
+				positions[numSets++] = 0;
 			}
+			positions[set] |= 1U << position;
 		}
-		targetContainer.addTargets(this->targets,maxIndexSize);
-		minSimilarity = DNA4::getLength() -  mismatches;
-		if(DNA4::getLength() < mismatches) minSimilarity = 0;//avoid underflow
+	}
 
-		if(targetContainer)
-		{
-			std::cout << "using index method" << std::endl;
-			bucketsArray = new TargetBucket[targetContainer.numberOfHashmaps()];
-		}
-		else
+	//the windows in windows, bit 63-i for the window at character i of the block, that pass the filter
+	uint64_t passing(const uint64_t masks[4], uint64_t windows) const
+	{
+		for(uint32_t set = 0; set < numSets; ++set)
 		{
-			std::cout << "Using simple method"<< std::endl;
-			matched1 = new uint32_t[targets.size()/2+1];
-			matched2 = new uint32_t[targets.size()/2+1];
+			uint64_t allowed = (bases[set]&1 ? masks[0] : 0) | (bases[set]&2 ? masks[1] : 0) | (bases[set]&4 ? masks[2] : 0) | (bases[set]&8 ? masks[3] : 0);
+			for(uint32_t p = positions[set]; p; p &= p-1)
+			{
+				windows &= allowed << __builtin_ctz(p);
+			}
 		}
+		return windows;
 	}
 
-	~OffTargetFinder()
+	//the window at character offset of the block, the same as DNA4::fromCharacters
+	template<uint32_t Length>
+	static DNA4 window(const uint64_t masks[4], uint32_t offset)
 	{
-		delete[] matched1;
-		delete[] matched2;
-		delete[] bucketsArray;
+		uint32_t shift = 64-offset-DNA4::lengthOf<Length>();
+		uint64_t mask = (1ULL<<DNA4::lengthOf<Length>())-1;
+		DNA4 d;
+		d[0] = (masks[0]>>shift&mask) << 32 | (masks[1]>>shift&mask);
+		d[1] = (masks[2]>>shift&mask) << 32 | (masks[3]>>shift&mask);
+		return d;
 	}
 
-	void findMatches(DNA4 & seq, size_t position, uint32_t seqID)
+	private:
+	uint32_t numSets;
+	//the bases allowed in a group of positions, 1 for A, 2 for C, 4 for G and 8 for T
+	uint32_t bases[15];
+	//bit i is set for position i of the window
+	uint32_t positions[15];
+};
+
+template<uint32_t Length, class Action>
+void scanSequence(const char * sequence, Filter filter, Action &action)
+{
+	size_t length = strlen(sequence);
+	if(length < DNA4::lengthOf<Length>())
+		return;
+	scanSequence<Length>(sequence,0,length-DNA4::lengthOf<Length>()+1,filter,action);
+}
+
+template<class Action>
+void doForTargetsInSequence(const char * sequence, Filter filter, Action &&action)
+{
+	withTargetLength([&](auto length)
+	{
+		scanSequence<decltype(length)::value>(sequence,filter,action);
+	});
+}
+
+template<class Action>
+void doForTargetsInSequence(const std::string &sequence, Filter filter, Action &&action)
+{
+	doForTargetsInSequence(sequence.data(),filter,action);
+}
+
+//does action for the windows starting at positions begin to end-1 of sequence that pass the filter
+template<uint32_t Length, class Action>
+void scanWindows(const char * sequence, size_t begin, size_t end, Filter filter, Action &action)
+{
+	DNA4 sequenceDNA4 = DNA4::fromCharacters<Length>(sequence+begin);
+	sequence+=DNA4::lengthOf<Length>()-1;
+	size_t currentPos = begin;
+	while(true)
 	{
-		if(targetContainer)
+		//check that it matches the filter
+		if(filter.passes(sequenceDNA4))
 		{
-			findMatchesWithIndex(seq, position, seqID);
+			action.doAction(sequenceDNA4,currentPos);
 		}
-		else
+		if(++currentPos==end)
+			return;
+		sequenceDNA4.addCharacter<Length>(sequence[currentPos]);
+	}
+}
+
+//does action for the windows starting at positions begin to end-1 of sequence that prefilter finds, 32 at a time
+template<uint32_t Length, class Action>
+void scanPrefilteredWindows(const char * sequence, size_t begin, size_t end, const WindowPrefilter &prefilter, Action &action)
+{
+	const size_t charactersEnd = end+DNA4::lengthOf<Length>()-1;
+	uint64_t masks[4];
+	for(size_t block = begin; block < end; block += 32)
+	{
+		findBases(sequence+block,charactersEnd-block,masks);
+		uint64_t windows = ~0ULL << (64-std::min<size_t>(end-block,32));
+		uint64_t passing = prefilter.passing(masks,windows);
+		COUNT_SEARCH_STATS(stats.windowsScanned += __builtin_popcountll(windows); stats.windowsPassingFilter += __builtin_popcountll(passing));
+		while(passing)
 		{
-			findMatchesSimple(seq, position, seqID);
+			uint32_t offset = __builtin_clzll(passing);
+			passing ^= 1ULL << (63-offset);
+			DNA4 window = WindowPrefilter::window<Length>(masks,offset);
+			action.doAction(window,block+offset);
 		}
 	}
+}
 
-	std::vector<OffTargetContainer> & getOffTargets()
+//does action for the targets starting at positions begin to end-1 of sequence
+//sequence must contain at least end+DNA4::getLength()-1 characters
+template<uint32_t Length, class Action>
+void scanSequence(const char * sequence, size_t begin, size_t end, Filter filter, Action &action)
+{
+	//without a filter every window passes, so they are built one character at a time
+	if(!filter.exists())
 	{
-		return offTargets;
+		forWindowsToScan(sequence,begin,end,DNA4::lengthOf<Length>(),filter,[&](size_t first, size_t last)
+		{
+			scanWindows<Length>(sequence,first,last,filter,action);
+		});
+		return;
 	}
+	WindowPrefilter prefilter(filter.asDNA4(),DNA4::lengthOf<Length>());
+	forWindowsToScan(sequence,begin,end,DNA4::lengthOf<Length>(),filter,[&](size_t first, size_t last)
+	{
+		scanPrefilteredWindows<Length>(sequence,first,last,prefilter,action);
+	});
+}
 
-	private:
-	void findMatchesWithIndex(DNA4 & seq, uint32_t position, uint32_t seqID)
+template<class Action>
+void doForTargetsInSequence(const char * sequence, size_t begin, size_t end, Filter filter, Action &&action)
+{
+	if(begin>=end)
+		return;
+	withTargetLength([&](auto length)
 	{
-		//naiveComparisons += targetContainer.numberOfTargets();
-		targetContainer.getBuckets(seq,bucketsArray);
-		for(size_t i = 0; i < targetContainer.numberOfHashmaps(); ++i)
+		scanSequence<decltype(length)::value>(sequence,begin,end,filter,action);
+	});
+}
+
+//does action for the targets on both strands of sequence, the reverse strand targets are passed to the action
+//as the reverse complement with Strand::reverse and the position of their first character on the forward strand
+template<uint32_t Length, class Action>
+void scanBothStrands(const char * sequence, Filter filter, Action &action)
+{
+	size_t length = strlen(sequence);
+	if(length < DNA4::lengthOf<Length>())
+		return;
+	scanBothStrands<Length>(sequence,0,length-DNA4::lengthOf<Length>()+1,filter,action);
+}
+
+template<class Action>
+void doForTargetsOnBothStrands(const char * sequence, Filter filter, Action &&action)
+{
+	withTargetLength([&](auto length)
+	{
+		scanBothStrands<decltype(length)::value>(sequence,filter,action);
+	});
+}
+
+template<class Action>
+void doForTargetsOnBothStrands(const std::string &sequence, Filter filter, Action &&action)
+{
+	doForTargetsOnBothStrands(sequence.data(),filter,action);
+}
+
+//does action for the windows on both strands starting at positions begin to end-1 of sequence that pass the filter
+template<uint32_t Length, class Action>
+void scanWindowsOnBothStrands(const char * sequence, size_t begin, size_t end, Filter filter, Action &action)
+{
+	DNA4 sequenceDNA4 = DNA4::fromCharacters<Length>(sequence+begin);
+	DNA4 reverseComplement = sequenceDNA4.reverseComplement();
+	sequence+=DNA4::lengthOf<Length>()-1;
+	size_t currentPos = begin;
+	while(true)
+	{
+		//check that it matches the filter
+		if(filter.passes(sequenceDNA4))
 		{
-			TargetBucket bucket = bucketsArray[i];
-			//std::cout << bucket.size << std::endl;
-			for(uint32_t targetNum = 0; targetNum<bucket.size; targetNum++)
-			{
-				uint32_t similarity = seq.getSimilarity(bucket.begin_DNA[targetNum]);
-				
-				if(similarity>=minSimilarity)
-				{
-					//std::cout << similarity <<std::endl;
-					uint32_t mismatch = DNA4::getLength()-similarity;
-					auto & targetMatches = offTargets[bucket.begin_position[targetNum]][mismatch];
-					OffTarget ot = OffTarget{{seqID,position},seq};
-					//make sure we haven't added this match from another hashmap already
-					if(targetMatches.size()==0||targetMatches.back()!=ot)
-					{
-						targetMatches.push_back(ot);
-					}
-				}
-			}
+			action.doAction(sequenceDNA4,currentPos,Strand::forward);
+		}
+		if(filter.passes(reverseComplement))
+		{
+			action.doAction(reverseComplement,currentPos,Strand::reverse);
 		}
+		if(++currentPos==end)
+			return;
+		sequenceDNA4.addCharacter<Length>(sequence[currentPos]);
+		reverseComplement.addReverseComplementCharacter<Length>(sequence[currentPos]);
 	}
+}
 
-	void findMatchesSimple(DNA4 & seq, uint32_t position, uint32_t seqID)
+//does action for the windows on both strands starting at positions begin to end-1 of sequence that forward and reverse find
+//the reverse strand windows are found by the prefilter of the reverse complement of the filter
+template<uint32_t Length, class Action>
+void scanPrefilteredWindowsOnBothStrands(const char * sequence, size_t begin, size_t end, const WindowPrefilter &forward,
+										 const WindowPrefilter &reverse, Action &action)
+{
+	const size_t charactersEnd = end+DNA4::lengthOf<Length>()-1;
+	uint64_t masks[4];
+	for(size_t block = begin; block < end; block += 32)
 	{
-		int numberOfMatches1 = 0;
-		int numberOfMatches2 = 0;
-
-		//compare all the targets with this sequence
-		for(size_t i = 0; i < targets.size()-1;i+=2)
+		findBases(sequence+block,charactersEnd-block,masks);
+		uint64_t windows = ~0ULL << (64-std::min<size_t>(end-block,32));
+		uint64_t forwardPassing = forward.passing(masks,windows);
+		uint64_t reversePassing = reverse.passing(masks,windows);
+		COUNT_SEARCH_STATS(stats.windowsScanned += 2*__builtin_popcountll(windows);
+						   stats.windowsPassingFilter += __builtin_popcountll(forwardPassing)+__builtin_popcountll(reversePassing));
+		for(uint64_t passing = forwardPassing | reversePassing; passing;)
 		{
-			if(seq.getSimilarity(targets[i])>=minSimilarity)
-			{
-				matched1[numberOfMatches1] = i;
-				numberOfMatches1++;
-			}
-			if(seq.getSimilarity(targets[i+1])>=minSimilarity)
+			uint32_t offset = __builtin_clzll(passing);
+			uint64_t bit = 1ULL << (63-offset);
+			passing ^= bit;
+			DNA4 window = WindowPrefilter::window<Length>(masks,offset);
+			if(forwardPassing & bit)
 			{
-				matched2[numberOfMatches2] = i+1;
-				numberOfMatches2++;
+				action.doAction(window,block+offset,Strand::forward);
 			}
-		}
-		if(targets.size()%2)
-		{
-			if(seq.getSimilarity(targets[targets.size()-1])>=minSimilarity)
+			if(reversePassing & bit)
 			{
-				matched1[numberOfMatches1] = targets.size()-1;
-				numberOfMatches1++;
+				DNA4 reverseComplement = window.reverseComplement();
+				action.doAction(reverseComplement,block+offset,Strand::reverse);
 			}
 		}
+	}
+}
 
-		for(int i = 0; i < numberOfMatches1;++i)
-		{
-			uint32_t mismatch = DNA4::getLength()-seq.getSimilarity(targets[matched1[i]]);
-			offTargets[matched1[i]][mismatch].push_back(OffTarget{{seqID,position},seq});
-		}	
-		for(int i = 0; i < numberOfMatches2;++i)
+//does action for the targets on both strands starting at positions begin to end-1 of sequence
+//sequence must contain at least end+DNA4::getLength()-1 characters
+template<uint32_t Length, class Action>
+void scanBothStrands(const char * sequence, size_t begin, size_t end, Filter filter, Action &action)
+{
+	if(!filter.exists())
+	{
+		forWindowsToScan(sequence,begin,end,DNA4::lengthOf<Length>(),filter,[&](size_t first, size_t last)
 		{
-			uint32_t mismatch = DNA4::getLength()-seq.getSimilarity(targets[matched2[i]]);
-			offTargets[matched2[i]][mismatch].push_back(OffTarget{{seqID,position},seq});
-		}
+			scanWindowsOnBothStrands<Length>(sequence,first,last,filter,action);
+		});
+		return;
 	}
+	WindowPrefilter forward(filter.asDNA4(),DNA4::lengthOf<Length>());
+	WindowPrefilter reverse(filter.asDNA4().reverseComplement(),DNA4::lengthOf<Length>());
+	forWindowsToScan(sequence,begin,end,DNA4::lengthOf<Length>(),filter,[&](size_t first, size_t last)
+	{
+		scanPrefilteredWindowsOnBothStrands<Length>(sequence,first,last,forward,reverse,action);
+	});
+}
 
-	std::vector<OffTargetContainer> offTargets;
-	TargetContainer targetContainer;
-	std::vector<DNA4> targets;
-	uint32_t * matched1;
-	uint32_t * matched2;
-	TargetBucket * bucketsArray;
-	uint_fast8_t minSimilarity;
-};
+template<class Action>
+void doForTargetsOnBothStrands(const char * sequence, size_t begin, size_t end, Filter filter, Action &&action)
+{
+	if(begin>=end)
+		return;
+	withTargetLength([&](auto length)
+	{
+		scanBothStrands<decltype(length)::value>(sequence,begin,end,filter,action);
+	});
+}
 
-struct FindIfOffTarget{
-	OffTargetFinder &offTargetFinder;
-	uint32_t sequenceID;
-	FindIfOffTarget(OffTargetFinder &offTargetFinder,uint32_t sequenceID)
-	:offTargetFinder(offTargetFinder),sequenceID(sequenceID)
-	{}
-	void doAction(DNA4 &t,uint32_t position)
+//the number of characters from begin to end-1 that are not line breaks
+size_t numberOfSequenceCharacters(const char * begin, const char * end)
+{
+	size_t numCharacters = 0;
+	while(begin < end)
 	{
-		offTargetFinder.findMatches(t,position,sequenceID);
+		const char *lineEnd = static_cast<const char*>(memchr(begin,'\n',end-begin));
+		if(lineEnd==nullptr)
+			lineEnd = end;
+		numCharacters += lineEnd-begin;
+		if(lineEnd>begin && lineEnd[-1]=='\r')
+			numCharacters--;
+		begin = lineEnd+1;
 	}
-};
-
-struct AddToSet{
-	DNA4Set &s;
-	AddToSet(DNA4Set & set)
-	:s(set){}
-	void doAction(DNA4 &t,uint32_t){s.insert(t);}
-};
-
-struct RemoveFromSet{
-	DNA4Set &s;
-	RemoveFromSet(DNA4Set & set)
-	:s(set){}
-	void doAction(DNA4 &t,uint32_t){s.remove(t);}
-};
+	return numCharacters;
+}
 
-struct AddToSetIfExistingInOtherSet{
-	DNA4Set &s;
-	DNA4Set &otherSet;
-	AddToSetIfExistingInOtherSet(DNA4Set &set, DNA4Set &otherSet)
-	:s(set),otherSet(otherSet){}
-	void doAction(DNA4 &t,uint32_t)
+template<uint32_t Length, class Action>
+void scanLines(const char * begin, const char * sequenceEnd, size_t numTargets, size_t firstPosition, Filter filter, Action &action, bool bothStrands)
+{
+	DNA4 sequenceDNA4;
+	DNA4 reverseComplement;
+	size_t charactersRead = 0;
+	//the number of characters read up to the end of the last run of ambiguous characters, the windows that have
+	//one of them are skipped, so the windows are only used once the target length of bases has been added after it
+	size_t ambiguousRead = 0;
+	const bool skipAmbiguous = !filter.keepsAmbiguousWindows();
+	for(const char *line = begin; line < sequenceEnd;)
 	{
-		if(otherSet.contains(t))
-			s.insert(t);
+		const char *lineEnd = static_cast<const char*>(memchr(line,'\n',sequenceEnd-line));
+		if(lineEnd==nullptr)
+			lineEnd = sequenceEnd;
+		const char *nextLine = lineEnd+1;
+		if(lineEnd>line && lineEnd[-1]=='\r')
+			lineEnd--;
+		for(const char *c = line; c < lineEnd;)
+		{
+			//the characters up to the next ambiguous one are bases
+			const char *basesEnd = skipAmbiguous ? findCharacter(c,lineEnd,false) : lineEnd;
+			for(; c < basesEnd; ++c)
+			{
+				sequenceDNA4.addCharacter<Length>(*c);
+				if(bothStrands)
+				{
+					reverseComplement.addReverseComplementCharacter<Length>(*c);
+				}
+				if(++charactersRead < ambiguousRead+DNA4::lengthOf<Length>())
+					continue;
+				size_t target = charactersRead-DNA4::lengthOf<Length>();
+				if(target>=numTargets)
+					return;
+				//check that it matches the filter
+				if(filter.passes(sequenceDNA4))
+				{
+					action.doAction(sequenceDNA4,firstPosition+target,Strand::forward);
+				}
+				if(bothStrands && filter.passes(reverseComplement))
+				{
+					action.doAction(reverseComplement,firstPosition+target,Strand::reverse);
+				}
+			}
+			if(c < lineEnd)
+			{
+				//the run is not added to the windows, as the characters before it are shifted out before they are used again
+				const char *runEnd = findCharacter(c,lineEnd,true);
+				charactersRead += runEnd-c;
+				ambiguousRead = charactersRead;
+				c = runEnd;
+			}
+		}
+		line = nextLine;
 	}
-};
+}
 
+//does action for the targets that start from begin to end-1 of a sequence that is split into lines, such as a fasta record
+//line breaks are skipped, and positions count sequence characters from the first one at or after begin, which is at firstPosition
+//begin and end must be at the start of a line, characters after end up to sequenceEnd are read to complete the last targets
 template<class Action>
-void doForTargetsInSequence(const char * sequence, Filter filter, Action &&action)
+void doForTargetsInLines(const char * begin, const char * end, const char * sequenceEnd, size_t firstPosition, Filter filter, Action &&action, bool bothStrands = false)
 {
-	for(size_t i = 0; i < DNA4::getLength();++i)
+	size_t numTargets = numberOfSequenceCharacters(begin,end);
+	if(numTargets==0)
+		return;
+	withTargetLength([&](auto length)
 	{
-		if(sequence[i]=='\0')
-		{
+		scanLines<decltype(length)::value>(begin,sequenceEnd,numTargets,firstPosition,filter,action,bothStrands);
+	});
+}
+
+//multithreaded search using numThreads threads (0 uses all available cores)
+//each thread searches with its own buffers through OffTargetFinder::findMatchesInSequence, the action is not called
+void doForTargetsInSequence(const char * sequence, Filter filter, const FindIfOffTarget &action, uint32_t numThreads)
+{
+	action.offTargetFinder.findMatchesInSequence(sequence,strlen(sequence),filter,action.sequenceID,numThreads);
+}
+
+void doForTargetsInSequence(const std::string &sequence, Filter filter, const FindIfOffTarget &action, uint32_t numThreads)
+{
+	action.offTargetFinder.findMatchesInSequence(sequence.data(),sequence.size(),filter,action.sequenceID,numThreads);
+}
+
+void doForTargetsOnBothStrands(const char * sequence, Filter filter, const FindIfOffTarget &action, uint32_t numThreads)
+{
+	action.offTargetFinder.findMatchesInSequence(sequence,strlen(sequence),filter,action.sequenceID,numThreads,OffTargetFinder::defaultChunkSize,true);
+}
+
+void doForTargetsOnBothStrands(const std::string &sequence, Filter filter, const FindIfOffTarget &action, uint32_t numThreads)
+{
+	action.offTargetFinder.findMatchesInSequence(sequence.data(),sequence.size(),filter,action.sequenceID,numThreads,OffTargetFinder::defaultChunkSize,true);
+}
+
+//the targets already collected by action are left for it to search
+void doForTargetsInSequence(const char * sequence, Filter filter, const FindIfOffTargetInBatches &action, uint32_t numThreads)
+{
+	action.offTargetFinder.findMatchesInSequence(sequence,strlen(sequence),filter,action.sequenceID,numThreads);
+}
+
+void doForTargetsInSequence(const std::string &sequence, Filter filter, const FindIfOffTargetInBatches &action, uint32_t numThreads)
+{
+	action.offTargetFinder.findMatchesInSequence(sequence.data(),sequence.size(),filter,action.sequenceID,numThreads);
+}
+
+void doForTargetsOnBothStrands(const char * sequence, Filter filter, const FindIfOffTargetInBatches &action, uint32_t numThreads)
+{
+	action.offTargetFinder.findMatchesInSequence(sequence,strlen(sequence),filter,action.sequenceID,numThreads,OffTargetFinder::defaultChunkSize,true);
+}
+
+void doForTargetsOnBothStrands(const std::string &sequence, Filter filter, const FindIfOffTargetInBatches &action, uint32_t numThreads)
+{
+	action.offTargetFinder.findMatchesInSequence(sequence.data(),sequence.size(),filter,action.sequenceID,numThreads,OffTargetFinder::defaultChunkSize,true);
+}
+
+//multithreaded scan of the length characters of sequence using numThreads threads (0 uses all available cores)
+//every thread uses action at the same time, so only the actions marked by isConcurrentAction can be used
+template<class Action>
+void doForTargetsInParallel(const char * sequence, size_t length, Filter filter, Action &action, uint32_t numThreads, bool bothStrands)
+{
+	static_assert(isConcurrentAction<typename std::remove_const<Action>::type>::value,"the action is used by every thread at the same time, use a set action on a ConcurrentDNA4Set");
+	if(length < DNA4::getLength())
 		return;
-		}
-	}
-	DNA4 sequenceDNA4 = DNA4(sequence);
-	sequence+=DNA4::getLength();
-	size_t currentPos = 0;
-	do
+	const size_t numWindows = length-DNA4::getLength()+1;
+	const size_t chunkSize = OffTargetFinder::defaultChunkSize;
+	runInParallel((numWindows+chunkSize-1)/chunkSize,numThreads,[&](size_t chunk, uint32_t)
 	{
-		//check that it matches the filter
-		if(filter.passes(sequenceDNA4))
-		{
-			action.doAction(sequenceDNA4,currentPos);
-		}
-		++currentPos;
-	}while(sequenceDNA4.addCharacter(*(sequence++)));
-		}
+		size_t begin = chunk*chunkSize;
+		size_t end = std::min(begin+chunkSize,numWindows);
+		if(bothStrands)
+			doForTargetsOnBothStrands(sequence,begin,end,filter,action);
+		else
+			doForTargetsInSequence(sequence,begin,end,filter,action);
+	});
+}
 
+//only chosen for the actions marked by isConcurrentAction, so an action that is not thread safe does not compile
 template<class Action>
-void doForTargetsInSequence(const std::string &sequence, Filter filter, Action &&action)
+using IfConcurrentAction = typename std::enable_if<isConcurrentAction<typename std::decay<Action>::type>::value,int>::type;
+
+template<class Action, IfConcurrentAction<Action> = 0>
+void doForTargetsInSequence(const char * sequence, Filter filter, Action &&action, uint32_t numThreads)
 {
-	doForTargetsInSequence(sequence.data(),filter,action);
+	doForTargetsInParallel(sequence,strlen(sequence),filter,action,numThreads,false);
+}
+
+template<class Action, IfConcurrentAction<Action> = 0>
+void doForTargetsInSequence(const std::string &sequence, Filter filter, Action &&action, uint32_t numThreads)
+{
+	doForTargetsInParallel(sequence.data(),sequence.size(),filter,action,numThreads,false);
 }
 
+template<class Action, IfConcurrentAction<Action> = 0>
+void doForTargetsOnBothStrands(const char * sequence, Filter filter, Action &&action, uint32_t numThreads)
+{
+	doForTargetsInParallel(sequence,strlen(sequence),filter,action,numThreads,true);
+}
+
+template<class Action, IfConcurrentAction<Action> = 0>
+void doForTargetsOnBothStrands(const std::string &sequence, Filter filter, Action &&action, uint32_t numThreads)
+{
+	doForTargetsInParallel(sequence.data(),sequence.size(),filter,action,numThreads,true);
+}
+
+//the sequence is read in blocks, and a window can span two of them, the ambiguous characters are skipped like scanLines does
 template<class Action>
 void doForTargetsInSequence(std::istream &seqStream, Filter filter, Action &&action)
 {
 	constexpr size_t buffSize = 4096;
-	char buf[buffSize+1];
-
-	seqStream.read(buf,buffSize);
-	if(seqStream.gcount()<DNA4::getLength())
-		return;
-	buf[seqStream.gcount()] = '\0';
-	DNA4 sequenceDNA4 = DNA4(buf);
-	size_t currentPos = 0;
-	char *c = &buf[DNA4::getLength()-1];
+	char buf[buffSize];
+	const size_t length = DNA4::getLength();
+	const bool skipAmbiguous = !filter.keepsAmbiguousWindows();
+	DNA4 sequenceDNA4;
+	size_t charactersRead = 0;
+	size_t ambiguousRead = 0;
 	do
-	{	
-		do
+	{
+		seqStream.read(buf,buffSize);
+		const char *end = buf+seqStream.gcount();
+		for(const char *c = buf; c < end;)
 		{
-			//check that it matches the filter
-			if(filter.passes(sequenceDNA4))
+			const char *basesEnd = skipAmbiguous ? findCharacter(c,end,false) : end;
+			for(; c < basesEnd; ++c)
+			{
+				sequenceDNA4.addCharacter(*c);
+				if(++charactersRead < ambiguousRead+length)
+					continue;
+				//check that it matches the filter
+				if(filter.passes(sequenceDNA4))
+				{
+					action.doAction(sequenceDNA4,charactersRead-length);
+				}
+			}
+			if(c < end)
 			{
-				action.doAction(sequenceDNA4,currentPos);
+				const char *runEnd = findCharacter(c,end,true);
+				charactersRead += runEnd-c;
+				ambiguousRead = charactersRead;
+				c = runEnd;
 			}
-			currentPos++;
-		}while(*(++c)&&sequenceDNA4.addCharacter(*c));
-		c = buf;
-		seqStream.read(buf,buffSize);
-		buf[seqStream.gcount()] = '\0';
-		//adds character since this was skipped above via short circuiting
-		//if gcount is 0 null will be added but we exit if this is the case anyway
-		sequenceDNA4.addCharacter(*c);
-	} while (seqStream.gcount()>0);
+		}
+	}while(seqStream.gcount()>0);
 }
\ No newline at end of file
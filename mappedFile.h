@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//a read only memory mapped file
+//the pages are shared with every other process that maps the same file
+class MappedFile
+{
+	public:
+	MappedFile()
+	:data(nullptr),fileSize(0)
+	{}
+
+	//an empty file is not mapped and isOpen will return false
+	MappedFile(const std::string &path)
+	:data(nullptr),fileSize(0)
+	{
+		int fd = open(path.c_str(),O_RDONLY);
+		if(fd==-1)
+		{
+			std::cout << "ERROR: could not open file \'" << path << "\'" << std::endl;
+			return;
+		}
+		struct stat fileStat;
+		if(fstat(fd,&fileStat)==0 && fileStat.st_size>0)
+		{
+			fileSize = fileStat.st_size;
+			void *mapped = mmap(nullptr,fileSize,PROT_READ,MAP_SHARED,fd,0);
+			if(mapped==MAP_FAILED)
+			{
+				std::cout << "ERROR: could not map file \'" << path << "\'" << std::endl;
+				fileSize = 0;
+			}
+			else
+			{
+				data = static_cast<const char*>(mapped);
+			}
+		}
+		close(fd);
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile &&o)
+	:data(o.data),fileSize(o.fileSize)
+	{
+		o.data = nullptr;
+		o.fileSize = 0;
+	}
+
+	MappedFile& operator=(MappedFile &&o)
+	{
+		std::swap(data,o.data);
+		std::swap(fileSize,o.fileSize);
+		return *this;
+	}
+
+	~MappedFile()
+	{
+		if(data)
+		{
+			munmap(const_cast<char*>(data),fileSize);
+		}
+	}
+
+	//tells the kernel the file will be read from start to end so it can read ahead
+	void adviseSequential() const
+	{
+		if(data)
+		{
+			madvise(const_cast<char*>(data),fileSize,MADV_SEQUENTIAL);
+		}
+	}
+
+	bool isOpen() const {return data;}
+
+	const char *begin() const {return data;}
+	const char *end() const {return data+fileSize;}
+	size_t size() const {return fileSize;}
+
+	private:
+	const char *data;
+	size_t fileSize;
+};
@@ -0,0 +1,455 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "fuzzyMatch.h"
+#include "fastaFile.h"
+
+//reads a sequence once for several configurations of target length, filter and search, such as 23 character targets
+//with an NGG PAM and 24 character targets with a TTTV PAM, instead of scanning the sequence once for each configuration
+//a thread has one target length at a time, so the sequence is scanned in batches of chunks, and the targets that pass each
+//configuration's filter are kept until the batch has been read, then the length is set to each configuration's length in turn
+//while its targets are searched for
+//the Filter, OffTargetFinder or DNA4Set of a configuration must have been made while the length was set to its length,
+//other threads can use DNA4 with their own lengths while a scan is running, the length set before the scan is set again when it finishes
+class MultiConfigurationScanner
+{
+	public:
+	MultiConfigurationScanner()
+	:scanCharacters(bestScanCharacters())
+	{}
+
+	//searches for the off targets of the targets of length length that pass filter with offTargetFinder,
+	//like FindIfOffTarget, the off targets are in the same order as a search of the sequence for this configuration alone
+	void addConfiguration(uint32_t length, Filter filter, OffTargetFinder &offTargetFinder)
+	{
+		configurations.emplace_back(new SearchConfiguration(length,filter,offTargetFinder));
+	}
+
+	//does action for the targets of length length that pass filter, in the order they are in the sequence
+	//the action is done by one thread at a time, and is not told the sequence ID
+	template<class Action>
+	void addConfiguration(uint32_t length, Filter filter, Action &action)
+	{
+		configurations.emplace_back(new ActionConfiguration<Action>(length,filter,action));
+	}
+
+	size_t numberOfConfigurations() const {return configurations.size();}
+
+	//scans the first length characters of sequence using numThreads threads (0 uses all available cores)
+	void scan(const char * sequence, size_t length, uint32_t seqID, bool bothStrands, uint32_t numThreads = 0, size_t chunkSize = OffTargetFinder::defaultChunkSize)
+	{
+		//there are no line breaks, so a chunk only needs to read the characters of the longest target after its end
+		size_t maxLength = 0;
+		for(const std::unique_ptr<Configuration> &c: configurations)
+		{
+			maxLength = std::max<size_t>(maxLength,c->length);
+		}
+		std::vector<Chunk> chunks;
+		for(size_t begin = 0; begin < length; begin += chunkSize)
+		{
+			size_t end = std::min(begin+chunkSize,length);
+			chunks.push_back(Chunk{seqID,sequence+begin,sequence+end,sequence+std::min(end+maxLength,length),begin});
+		}
+		scanChunks(chunks,bothStrands,numThreads);
+	}
+
+	void scan(const std::string &sequence, uint32_t seqID, bool bothStrands, uint32_t numThreads = 0)
+	{
+		scan(sequence.data(),sequence.size(),seqID,bothStrands,numThreads);
+	}
+
+	//scans every record of fasta, the targets in record i get the seqID firstSeqID+i
+	void scan(const FastaFile &fasta, uint32_t firstSeqID, bool bothStrands, uint32_t numThreads = 0, size_t chunkSize = OffTargetFinder::defaultChunkSize)
+	{
+		std::vector<Chunk> chunks;
+		for(const FastaChunk &c: splitIntoChunks(fasta,chunkSize,numThreads))
+		{
+			chunks.push_back(Chunk{firstSeqID+c.record,c.begin,c.end,fasta[c.record].end,c.firstPosition});
+		}
+		scanChunks(chunks,bothStrands,numThreads);
+	}
+
+	private:
+	//a part of a sequence that may be split into lines, characters after end up to sequenceEnd are read to complete the last targets
+	struct Chunk
+	{
+		uint32_t seqID;
+		const char *begin;
+		const char *end;
+		const char *sequenceEnd;
+		size_t firstPosition;
+	};
+
+	//a target found while scanning that passes the filter of a configuration
+	struct Target
+	{
+		DNA4 sequence;
+		uint32_t position;
+		Strand strand;
+	};
+
+	struct Configuration
+	{
+		Configuration(uint32_t length, Filter filter)
+		:length(length),filter(filter)
+		{}
+		virtual ~Configuration(){}
+		//does the configuration's search for the targets found in each chunk, the length is set to the configuration's length
+		virtual void search(const Chunk *chunks, std::vector<Target> *targetsInChunk, size_t numChunks, uint32_t numThreads) = 0;
+		uint32_t length;
+		Filter filter;
+	};
+
+	struct SearchConfiguration : public Configuration
+	{
+		SearchConfiguration(uint32_t length, Filter filter, OffTargetFinder &offTargetFinder)
+		:Configuration(length,filter),offTargetFinder(offTargetFinder)
+		{}
+		void search(const Chunk *chunks, std::vector<Target> *targetsInChunk, size_t numChunks, uint32_t numThreads) override
+		{
+			offTargetFinder.findMatchesInChunks(numChunks,numThreads,[&](size_t chunk, auto &action)
+			{
+				action.sequenceID = chunks[chunk].seqID;
+				for(Target &t: targetsInChunk[chunk])
+				{
+					action.doAction(t.sequence,t.position,t.strand);
+				}
+			});
+		}
+		OffTargetFinder &offTargetFinder;
+	};
+
+	template<class Action>
+	struct ActionConfiguration : public Configuration
+	{
+		ActionConfiguration(uint32_t length, Filter filter, Action &action)
+		:Configuration(length,filter),action(action)
+		{}
+		void search(const Chunk *, std::vector<Target> *targetsInChunk, size_t numChunks, uint32_t) override
+		{
+			for(size_t chunk = 0; chunk < numChunks; ++chunk)
+			{
+				for(Target &t: targetsInChunk[chunk])
+				{
+					action.doAction(t.sequence,t.position,t.strand);
+				}
+			}
+		}
+		Action &action;
+	};
+
+	//the targets of every configuration end at the same character, so only a 32 character window is kept on each strand
+	//the forward target of a configuration is the last length characters of the window and its reverse complement
+	//is the first length characters of the reverse complement of the window
+	//a filter check is made at each character for each configuration on each strand scanned, the reverse strand filters
+	//are shifted to where the targets are in the reverse complement window so neither window has to be shifted to check them
+	struct FilterChecks
+	{
+		std::vector<uint64_t> filterACs;
+		std::vector<uint64_t> filterGTs;
+		std::vector<uint64_t> numFilterChars;
+		std::vector<uint64_t> lengths;
+		//the number of bases that have to have been read after the last ambiguous character for a target of the check
+		//to be added, its length, or 0 if its configuration's filter keeps ambiguous windows
+		std::vector<uint64_t> basesNeeded;
+		std::vector<Strand> strands;
+		std::vector<uint32_t> configurations;
+		//true if a configuration skips ambiguous windows, then the lines are scanned in runs of bases and of ambiguous characters
+		bool findAmbiguousRuns;
+		//true if no configuration keeps ambiguous windows, then the runs of ambiguous characters are not added to the windows
+		bool skipAmbiguousRuns;
+		size_t size() const {return lengths.size();}
+	};
+
+	//the state of the scan of a chunk, which is carried from one line to the next
+	struct ChunkScan
+	{
+		const FilterChecks &checks;
+		//the targets of each configuration found in the chunk
+		std::vector<Target> **targets;
+		bool bothStrands;
+		//the number of targets that start in the chunk
+		size_t numTargets;
+		size_t firstPosition;
+		//the scan is done once this many characters have been read
+		size_t lastCharacter;
+		size_t charactersRead;
+		//the number of characters read up to the end of the last run of ambiguous characters
+		size_t ambiguousRead;
+		DNA4 window;
+		DNA4 reverseComplementWindow;
+	};
+
+	//scans the characters from c to end-1 of a line, returns true once the last character of the chunk has been read
+	typedef bool (*ScanCharacters)(const char *c, const char *end, ChunkScan &scan);
+
+	//adds the target of a filter check that ends at the last character read, target is its number in the chunk
+	static void addTarget(ChunkScan &scan, const DNA4 &window, const DNA4 &reverseComplementWindow, size_t check, size_t target)
+	{
+		uint32_t length = scan.checks.lengths[check];
+		uint64_t mask = DNA4::fullMaskOf(length);
+		Strand strand = scan.checks.strands[check];
+		DNA4 sequence;
+		if(strand==Strand::forward)
+		{
+			sequence[0] = window[0] & mask;
+			sequence[1] = window[1] & mask;
+		}
+		else
+		{
+			sequence[0] = reverseComplementWindow[0] >> (32-length) & mask;
+			sequence[1] = reverseComplementWindow[1] >> (32-length) & mask;
+		}
+		scan.targets[scan.checks.configurations[check]]->push_back(Target{sequence,uint32_t(scan.firstPosition+target),strand});
+	}
+
+	static bool scanCharactersScalar(const char *c, const char *end, ChunkScan &scan)
+	{
+		const FilterChecks &checks = scan.checks;
+		const uint64_t *filterACs = checks.filterACs.data();
+		const uint64_t *filterGTs = checks.filterGTs.data();
+		const uint64_t *numFilterChars = checks.numFilterChars.data();
+		const uint64_t *lengths = checks.lengths.data();
+		const uint64_t *basesNeeded = checks.basesNeeded.data();
+		//the forward strand checks come before the reverse strand checks
+		const size_t numChecks = checks.size();
+		const size_t numForwardChecks = scan.bothStrands ? numChecks/2 : numChecks;
+		const size_t numTargets = scan.numTargets;
+		DNA4 window = scan.window;
+		DNA4 reverseComplementWindow = scan.reverseComplementWindow;
+		size_t charactersRead = scan.charactersRead;
+		const size_t ambiguousRead = scan.ambiguousRead;
+		bool done = false;
+		for(; c < end && !done; ++c)
+		{
+			window.addCharacter<32>(*c);
+			if(scan.bothStrands)
+			{
+				reverseComplementWindow.addReverseComplementCharacter<32>(*c);
+			}
+			++charactersRead;
+			for(size_t i = 0; i < numChecks; ++i)
+			{
+				//this also skips the characters before the first target has been read, as the difference wraps around
+				size_t target = charactersRead-lengths[i];
+				if(target >= numTargets || (basesNeeded[i] && charactersRead < ambiguousRead+basesNeeded[i]))
+					continue;
+				const DNA4 &w = i < numForwardChecks ? window : reverseComplementWindow;
+				if(uint64_t(__builtin_popcountll((w[0]&filterACs[i])|(w[1]&filterGTs[i])))==numFilterChars[i])
+				{
+					addTarget(scan,window,reverseComplementWindow,i,target);
+				}
+			}
+			done = charactersRead==scan.lastCharacter;
+		}
+		scan.window = window;
+		scan.reverseComplementWindow = reverseComplementWindow;
+		scan.charactersRead = charactersRead;
+		return done;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	//makes up to 8 filter checks at once, each in a 64 bit lane
+	__attribute__((target("avx512f,avx512vpopcntdq")))
+	static bool scanCharactersAVX512(const char *c, const char *end, ChunkScan &scan)
+	{
+		const FilterChecks &checks = scan.checks;
+		alignas(64) uint64_t lanes[5][8] = {};
+		__mmask8 reverseLanes = 0;
+		for(size_t i = 0; i < checks.size(); ++i)
+		{
+			lanes[0][i] = checks.filterACs[i];
+			lanes[1][i] = checks.filterGTs[i];
+			lanes[2][i] = checks.numFilterChars[i];
+			lanes[3][i] = checks.lengths[i];
+			lanes[4][i] = checks.basesNeeded[i];
+			if(checks.strands[i]==Strand::reverse)
+				reverseLanes |= 1 << i;
+		}
+		const __mmask8 usedLanes = (1 << checks.size())-1;
+		const __m512i filterACs = _mm512_load_si512(lanes[0]);
+		const __m512i filterGTs = _mm512_load_si512(lanes[1]);
+		const __m512i numFilterChars = _mm512_load_si512(lanes[2]);
+		const __m512i lengths = _mm512_load_si512(lanes[3]);
+		const __m512i basesNeeded = _mm512_load_si512(lanes[4]);
+		const __mmask8 keptLanes = _mm512_cmpeq_epu64_mask(basesNeeded,_mm512_setzero_si512());
+		const __m512i ambiguousReads = _mm512_set1_epi64(scan.ambiguousRead);
+		const __m512i numTargets = _mm512_set1_epi64(scan.numTargets);
+		DNA4 window = scan.window;
+		DNA4 reverseComplementWindow = scan.reverseComplementWindow;
+		size_t charactersRead = scan.charactersRead;
+		bool done = false;
+		for(; c < end && !done; ++c)
+		{
+			window.addCharacter<32>(*c);
+			if(scan.bothStrands)
+			{
+				reverseComplementWindow.addReverseComplementCharacter<32>(*c);
+			}
+			++charactersRead;
+			__m512i windowAC = _mm512_mask_set1_epi64(_mm512_set1_epi64(window[0]),reverseLanes,reverseComplementWindow[0]);
+			__m512i windowGT = _mm512_mask_set1_epi64(_mm512_set1_epi64(window[1]),reverseLanes,reverseComplementWindow[1]);
+			//(windowAC & filterACs) | (windowGT & filterGTs), 0xEA is the truth table of (a & b) | c
+			__m512i similarity = _mm512_popcnt_epi64(_mm512_ternarylogic_epi64(windowAC,filterACs,_mm512_and_si512(windowGT,filterGTs),0xEA));
+			__m512i targets = _mm512_sub_epi64(_mm512_set1_epi64(charactersRead),lengths);
+			__mmask8 started = _mm512_mask_cmplt_epu64_mask(usedLanes,targets,numTargets);
+			started &= _mm512_cmpge_epu64_mask(_mm512_set1_epi64(charactersRead),_mm512_add_epi64(ambiguousReads,basesNeeded)) | keptLanes;
+			for(uint32_t passed = _mm512_mask_cmpeq_epu64_mask(started,similarity,numFilterChars); passed; passed &= passed-1)
+			{
+				uint32_t lane = __builtin_ctz(passed);
+				addTarget(scan,window,reverseComplementWindow,lane,charactersRead-lanes[3][lane]);
+			}
+			done = charactersRead==scan.lastCharacter;
+		}
+		scan.window = window;
+		scan.reverseComplementWindow = reverseComplementWindow;
+		scan.charactersRead = charactersRead;
+		return done;
+	}
+
+	//the vector scan makes at most 8 checks at once
+	static bool scanCharactersAVX512OrScalar(const char *c, const char *end, ChunkScan &scan)
+	{
+		if(scan.checks.size() <= 8)
+			return scanCharactersAVX512(c,end,scan);
+		return scanCharactersScalar(c,end,scan);
+	}
+#endif
+
+	//picks the widest scan the cpu supports
+	static ScanCharacters bestScanCharacters()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq"))
+			return scanCharactersAVX512OrScalar;
+#endif
+		return scanCharactersScalar;
+	}
+
+	FilterChecks makeFilterChecks(bool bothStrands) const
+	{
+		FilterChecks checks;
+		checks.findAmbiguousRuns = std::any_of(configurations.begin(),configurations.end(),[](const std::unique_ptr<Configuration> &c)
+		{
+			return !c->filter.keepsAmbiguousWindows();
+		});
+		checks.skipAmbiguousRuns = std::none_of(configurations.begin(),configurations.end(),[](const std::unique_ptr<Configuration> &c)
+		{
+			return c->filter.keepsAmbiguousWindows();
+		});
+		for(uint32_t strand = 0; strand < (bothStrands ? 2u : 1u); ++strand)
+		{
+			for(uint32_t c = 0; c < configurations.size(); ++c)
+			{
+				uint32_t length = configurations[c]->length;
+				DNA4 filter = configurations[c]->filter.asDNA4();
+				uint32_t shift = strand ? 32-length : 0;
+				checks.filterACs.push_back(filter[0] << shift);
+				checks.filterGTs.push_back(filter[1] << shift);
+				checks.numFilterChars.push_back(configurations[c]->filter.numberOfFilterChars());
+				checks.lengths.push_back(length);
+				checks.basesNeeded.push_back(configurations[c]->filter.keepsAmbiguousWindows() ? 0 : length);
+				checks.strands.push_back(Strand(strand));
+				checks.configurations.push_back(c);
+			}
+		}
+		return checks;
+	}
+
+	void scanChunks(const std::vector<Chunk> &chunks, bool bothStrands, uint32_t numThreads)
+	{
+		if(configurations.empty() || chunks.empty())
+			return;
+		numThreads = numberOfThreadsToUse(numThreads,chunks.size());
+		const FilterChecks checks = makeFilterChecks(bothStrands);
+		//a few chunks per thread keeps the threads busy while only holding the targets of a few chunks at a time
+		const size_t chunksPerBatch = 4*numThreads;
+		//the targets of configuration c in chunk i of the batch are in targetsInChunk[c][i]
+		std::vector<std::vector<std::vector<Target> > > targetsInChunk(configurations.size(),std::vector<std::vector<Target> >(chunksPerBatch));
+		const uint32_t originalLength = DNA4::getLength();
+		for(size_t firstChunk = 0; firstChunk < chunks.size(); firstChunk += chunksPerBatch)
+		{
+			size_t numChunks = std::min(chunksPerBatch,chunks.size()-firstChunk);
+			runInParallel(numChunks,numThreads,[&](size_t chunk, uint32_t)
+			{
+				std::vector<std::vector<Target>*> targets;
+				for(size_t c = 0; c < configurations.size(); ++c)
+				{
+					targetsInChunk[c][chunk].clear();
+					targets.push_back(&targetsInChunk[c][chunk]);
+				}
+				scanChunk(chunks[firstChunk+chunk],checks,targets.data(),bothStrands);
+			});
+			for(size_t c = 0; c < configurations.size(); ++c)
+			{
+				DNA4::setLength(configurations[c]->length);
+				configurations[c]->search(&chunks[firstChunk],targetsInChunk[c].data(),numChunks,numThreads);
+			}
+		}
+		DNA4::setLength(originalLength);
+	}
+
+	//adds the targets of each configuration that start in chunk and pass its filter to its targets
+	//in the same order as doForTargetsInLines would do its action for them
+	void scanChunk(const Chunk &chunk, const FilterChecks &checks, std::vector<Target> **targets, bool bothStrands) const
+	{
+		size_t numTargets = numberOfSequenceCharacters(chunk.begin,chunk.end);
+		if(numTargets==0)
+			return;
+		size_t maxLength = *std::max_element(checks.lengths.begin(),checks.lengths.end());
+		ChunkScan scan{checks,targets,bothStrands,numTargets,chunk.firstPosition,numTargets+maxLength-1,0,0,DNA4(),DNA4()};
+		for(const char *line = chunk.begin; line < chunk.sequenceEnd;)
+		{
+			const char *lineEnd = static_cast<const char*>(memchr(line,'\n',chunk.sequenceEnd-line));
+			if(lineEnd==nullptr)
+				lineEnd = chunk.sequenceEnd;
+			const char *nextLine = lineEnd+1;
+			if(lineEnd>line && lineEnd[-1]=='\r')
+				lineEnd--;
+			if(scanLine(line,lineEnd,scan))
+				return;
+			line = nextLine;
+		}
+	}
+
+	//scans the characters from c to end-1 of a line like scanCharacters, in runs of bases and runs of ambiguous characters
+	//when a configuration skips the windows that have ambiguous characters
+	bool scanLine(const char *c, const char *end, ChunkScan &scan) const
+	{
+		if(!scan.checks.findAmbiguousRuns)
+			return scanCharacters(c,end,scan);
+		while(c < end)
+		{
+			const char *ambiguous = findCharacter(c,end,false);
+			if(ambiguous > c && scanCharacters(c,ambiguous,scan))
+				return true;
+			if(ambiguous==end)
+				return false;
+			const char *runEnd = findCharacter(ambiguous,end,true);
+			if(scan.checks.skipAmbiguousRuns)
+			{
+				//every window is only checked again once its length of bases has been read, so the run is not added to them
+				scan.charactersRead += std::min<size_t>(runEnd-ambiguous,scan.lastCharacter-scan.charactersRead);
+				scan.ambiguousRead = scan.charactersRead;
+				if(scan.charactersRead==scan.lastCharacter)
+					return true;
+			}
+			else
+			{
+				//the configurations that keep ambiguous windows check the windows that end in the run
+				scan.ambiguousRead = scan.charactersRead+(runEnd-ambiguous);
+				if(scanCharacters(ambiguous,runEnd,scan))
+					return true;
+			}
+			c = runEnd;
+		}
+		return false;
+	}
+
+	std::vector<std::unique_ptr<Configuration> > configurations;
+	ScanCharacters scanCharacters;
+};
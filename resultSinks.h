@@ -0,0 +1,342 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include "fuzzyMatch.h"
+
+//a match as it is stored in a file written by BinaryFileSink, in the byte order of the machine that wrote it
+struct MatchRecord
+{
+	uint32_t targetIndex;
+	uint32_t seqID;
+	uint32_t positionInSeq;
+	uint8_t mismatches;
+	uint8_t strand;
+	uint16_t reserved;
+	DNA4 offTargetSequence;
+};
+
+//writes the matches to a binary file of MatchRecords in blocks of recordsPerBlock records
+//each block is written as soon as it is full, so the file can be read with readRecords while the search is still running
+class BinaryFileSink : public OffTargetFinder::ResultSink
+{
+	public:
+	BinaryFileSink(const std::string &path, size_t recordsPerBlock = 1<<14)
+	:file(path,std::ios::binary),recordsPerBlock(recordsPerBlock),recordsWritten(0)
+	{
+		if(!file)
+		{
+			std::cout << "ERROR: could not create match file \'" << path << "\'" << std::endl;
+		}
+		block.reserve(recordsPerBlock);
+	}
+
+	~BinaryFileSink()
+	{
+		flush();
+	}
+
+	bool isOpen() const {return bool(file);}
+
+	void addMatches(const OffTargetFinder::Match *matches, size_t numMatches) override
+	{
+		for(size_t i = 0; i < numMatches; ++i)
+		{
+			const OffTargetFinder::Match &m = matches[i];
+			const OffTargetFinder::Position &p = m.offTarget.position;
+			block.push_back(MatchRecord{m.targetIndex,p.seqID,p.positionInSeq,uint8_t(m.mismatches),uint8_t(p.strand),0,m.offTarget.offTargetSequence});
+			if(block.size()==recordsPerBlock)
+			{
+				writeBlock();
+			}
+		}
+	}
+
+	//writes the records of the partly filled block
+	void flush() override
+	{
+		writeBlock();
+	}
+
+	size_t numberOfRecords() const {return recordsWritten+block.size();}
+
+	//reads the records of path from firstRecord on, only complete records are read
+	static std::vector<MatchRecord> readRecords(const std::string &path, size_t firstRecord = 0)
+	{
+		std::vector<MatchRecord> records;
+		std::ifstream file(path,std::ios::binary|std::ios::ate);
+		if(!file)
+		{
+			std::cout << "ERROR: could not open match file \'" << path << "\'" << std::endl;
+			return records;
+		}
+		size_t numRecords = size_t(file.tellg())/sizeof(MatchRecord);
+		if(numRecords <= firstRecord)
+			return records;
+		records.resize(numRecords-firstRecord);
+		file.seekg(firstRecord*sizeof(MatchRecord));
+		file.read(reinterpret_cast<char*>(records.data()),records.size()*sizeof(MatchRecord));
+		return records;
+	}
+
+	private:
+	void writeBlock()
+	{
+		if(block.empty())
+			return;
+		file.write(reinterpret_cast<const char*>(block.data()),block.size()*sizeof(MatchRecord));
+		file.flush();
+		recordsWritten += block.size();
+		block.clear();
+	}
+
+	std::ofstream file;
+	size_t recordsPerBlock;
+	size_t recordsWritten;
+	std::vector<MatchRecord> block;
+};
+
+//holds at most capacity matches in memory for another thread to take while the search is running
+//the search waits while the queue is full, so something has to be taking the matches, and close must be
+//called once the searches are done so the taker knows there are no more
+class MatchQueue : public OffTargetFinder::ResultSink
+{
+	public:
+	typedef OffTargetFinder::Match Match;
+
+	MatchQueue(size_t capacity)
+	:capacity(capacity),closed(false)
+	{}
+
+	void addMatches(const Match *matches, size_t numMatches) override
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for(size_t i = 0; i < numMatches;)
+		{
+			notFull.wait(lock,[&]{return queued.size() < capacity;});
+			size_t count = std::min(numMatches-i,capacity-queued.size());
+			queued.insert(queued.end(),matches+i,matches+i+count);
+			i += count;
+			notEmpty.notify_all();
+		}
+	}
+
+	//no more matches will be added
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		notEmpty.notify_all();
+	}
+
+	//replaces matches with the queued matches, waiting until there are some
+	//returns false once the queue has been closed and every match has been taken
+	bool take(std::vector<Match> &matches)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock,[&]{return queued.size() || closed;});
+		matches.clear();
+		matches.swap(queued);
+		notFull.notify_all();
+		return matches.size();
+	}
+
+	private:
+	size_t capacity;
+	bool closed;
+	std::vector<Match> queued;
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+};
+
+//an off target kept by CompactResultStore, its sequence is the one at its position in the searched sequence
+struct CompactOffTarget
+{
+	uint32_t positionInSeq;
+	//the sequence ID in the high 31 bits and the strand in the lowest bit
+	uint32_t seqIDAndStrand;
+	uint32_t seqID() const {return seqIDAndStrand >> 1;}
+	Strand strand() const {return Strand(seqIDAndStrand & 1);}
+	OffTargetFinder::Position position() const {return OffTargetFinder::Position{seqID(),positionInSeq,strand()};}
+};
+
+//the off targets of one target at one distance, in the order they were found
+struct CompactOffTargets
+{
+	const CompactOffTarget *first;
+	const CompactOffTarget *last;
+	const CompactOffTarget *begin() const {return first;}
+	const CompactOffTarget *end() const {return last;}
+	size_t size() const {return last-first;}
+	const CompactOffTarget &operator[](size_t i) const {return first[i];}
+};
+
+//keeps the matches in a fraction of the memory of the OffTargetContainers, set it as the result sink of an OffTargetFinder
+//while searching each match is appended to a chunked arena as a packed 12 byte record, so storing a match never moves
+//the matches before it, then finish groups them by target and distance into 8 bytes each
+class CompactResultStore : public OffTargetFinder::ResultSink
+{
+	public:
+	//the sequence IDs searched must be below maxSeqIDs, the matches in other sequences are reported as an error and not stored
+	//the distance is stored in 5 bits, so with more than maxMismatches mismatches nothing is stored
+	CompactResultStore(uint32_t numTargets, uint32_t mismatches)
+	:numTargets(numTargets),distances(mismatches+1),numMatches(0),usedInLastBlock(blockSize),seqIDTooLarge(false),finished(false),addedAfterFinish(false)
+	{
+		if(mismatches > maxMismatches)
+		{
+			std::cout << "ERROR: a CompactResultStore stores matches with up to " << maxMismatches << " mismatches, not "
+					  << mismatches << ", no matches will be stored" << std::endl;
+		}
+	}
+
+	static constexpr uint32_t maxSeqIDs = 1U << 26;
+	static constexpr uint32_t maxMismatches = 31;
+
+	void addMatches(const OffTargetFinder::Match *matches, size_t numNewMatches) override
+	{
+		if(finished)
+		{
+			if(!addedAfterFinish)
+			{
+				std::cout << "ERROR: matches were passed to a CompactResultStore after finish was called, they are not stored" << std::endl;
+				addedAfterFinish = true;
+			}
+			return;
+		}
+		if(distances > maxMismatches+1)
+			return;
+		for(size_t i = 0; i < numNewMatches; ++i)
+		{
+			const OffTargetFinder::Match &m = matches[i];
+			const OffTargetFinder::Position &p = m.offTarget.position;
+			if(p.seqID >= maxSeqIDs)
+			{
+				if(!seqIDTooLarge)
+				{
+					std::cout << "ERROR: sequence ID " << p.seqID << " does not fit in a CompactResultStore, which stores sequence IDs below "
+							  << maxSeqIDs << ", the matches in those sequences are not stored" << std::endl;
+					seqIDTooLarge = true;
+				}
+				continue;
+			}
+			if(usedInLastBlock==blockSize)
+			{
+				arena.emplace_back(new PackedMatch[blockSize]);
+				usedInLastBlock = 0;
+			}
+			arena.back()[usedInLastBlock++] = PackedMatch{m.targetIndex,p.positionInSeq,p.seqID << 6 | uint32_t(p.strand) << 5 | m.mismatches};
+			++numMatches;
+		}
+	}
+
+	//groups the matches by target and distance so they can be read, call it once every search has finished and been flushed
+	//the matches within each group stay in the order they were found, calling it again does nothing
+	void finish()
+	{
+		if(finished)
+			return;
+		finished = true;
+		//count the matches of each target and distance, then make the counts the offset of the start of each group
+		offsets.assign(uint64_t(numTargets)*distances+1,0);
+		forEachPackedMatch([&](const PackedMatch &m)
+		{
+			offsets[group(m)+1]++;
+		});
+		for(size_t i = 1; i < offsets.size(); ++i)
+		{
+			offsets[i] += offsets[i-1];
+		}
+		grouped.resize(numMatches);
+		for(size_t b = 0; b < arena.size(); ++b)
+		{
+			size_t used = b+1==arena.size() ? usedInLastBlock : blockSize;
+			for(size_t i = 0; i < used; ++i)
+			{
+				const PackedMatch &m = arena[b][i];
+				grouped[offsets[group(m)]++] = CompactOffTarget{m.positionInSeq,(m.seqStrandAndDistance >> 5)};
+			}
+			arena[b].reset();
+		}
+		//each offset has moved on to the start of the next group
+		for(size_t i = offsets.size()-1; i > 0; --i)
+		{
+			offsets[i] = offsets[i-1];
+		}
+		offsets[0] = 0;
+		arena.clear();
+		usedInLastBlock = blockSize;
+	}
+
+	//the off targets of one target, like an OffTargetContainer
+	class TargetOffTargets
+	{
+		public:
+		TargetOffTargets(const CompactResultStore &store, uint32_t target)
+		:store(store),target(target)
+		{}
+		CompactOffTargets operator[](uint32_t distance) const {return store.getOffTargets(target,distance);}
+		CompactOffTargets getOffTargets(uint32_t distance) const {return store.getOffTargets(target,distance);}
+		private:
+		const CompactResultStore &store;
+		uint32_t target;
+	};
+
+	TargetOffTargets operator[](uint32_t target) const {return TargetOffTargets(*this,target);}
+
+	//the off targets of target at distance, there are none until finish has been called
+	CompactOffTargets getOffTargets(uint32_t target, uint32_t distance) const
+	{
+		if(!finished)
+			return CompactOffTargets{nullptr,nullptr};
+		const uint64_t *groupOffsets = &offsets[uint64_t(target)*distances+distance];
+		return CompactOffTargets{grouped.data()+groupOffsets[0],grouped.data()+groupOffsets[1]};
+	}
+
+	size_t size() const {return numMatches;}
+
+	private:
+	//the sequence ID in the high 26 bits, then the strand and the distance in the low 5 bits
+	struct PackedMatch
+	{
+		uint32_t targetIndex;
+		uint32_t positionInSeq;
+		uint32_t seqStrandAndDistance;
+	};
+
+	static constexpr size_t blockSize = 1<<20;
+
+	uint64_t group(const PackedMatch &m) const
+	{
+		return uint64_t(m.targetIndex)*distances + (m.seqStrandAndDistance & 31);
+	}
+
+	template<class Function>
+	void forEachPackedMatch(Function &&function) const
+	{
+		for(size_t b = 0; b < arena.size(); ++b)
+		{
+			size_t used = b+1==arena.size() ? usedInLastBlock : blockSize;
+			for(size_t i = 0; i < used; ++i)
+			{
+				function(arena[b][i]);
+			}
+		}
+	}
+
+	uint32_t numTargets;
+	uint32_t distances;
+	size_t numMatches;
+	std::vector<std::unique_ptr<PackedMatch[]> > arena;
+	size_t usedInLastBlock;
+	bool seqIDTooLarge;
+	bool finished;
+	bool addedAfterFinish;
+	//after finish the off targets of target t at distance d are grouped[offsets[t*distances+d]] to grouped[offsets[t*distances+d+1]-1]
+	std::vector<uint64_t> offsets;
+	std::vector<CompactOffTarget> grouped;
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+//records spans of time on every thread, such as the phases of building an index or of a search, and writes them as
+//chrome trace events that can be opened in chrome://tracing or Perfetto
+//a span is recorded by a TraceScope from when it is created until it is destroyed, so spans nest like the scopes do
+//nothing is recorded until enable is called, then each thread records into a ring buffer that is allocated once,
+//so once it is full the oldest spans are overwritten, a span costs two clock reads so coarse spans can be left enabled
+class Tracer
+{
+	public:
+	struct Span
+	{
+		//a string literal, only the pointer is kept
+		const char *name;
+		//nanoseconds since the tracer was created
+		int64_t begin;
+		int64_t end;
+	};
+
+	static Tracer &instance()
+	{
+		static Tracer tracer;
+		return tracer;
+	}
+
+	//starts recording, each thread keeps its latest spansPerThread spans
+	//threads that have already recorded keep the size of ring buffer they were given
+	void enable(size_t spansPerThread = 1<<16)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->spansPerThread = std::max<size_t>(spansPerThread,1);
+		isEnabled.store(true,std::memory_order_relaxed);
+	}
+
+	//stops recording, the spans already recorded are kept
+	void disable()
+	{
+		isEnabled.store(false,std::memory_order_relaxed);
+	}
+
+	bool enabled() const
+	{
+		return isEnabled.load(std::memory_order_relaxed);
+	}
+
+	int64_t now() const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-epoch).count();
+	}
+
+	void record(const char *name, int64_t begin, int64_t end)
+	{
+		threadBuffer().add(Span{name,begin,end});
+	}
+
+	//forgets every span recorded so far, while nothing is being traced
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(std::unique_ptr<RingBuffer> &buffer: buffers)
+		{
+			buffer->numSpans = 0;
+			buffer->next = 0;
+		}
+	}
+
+	//writes the spans as trace events, each thread is shown as the ring buffer it recorded into, which a thread
+	//takes over from a thread that has exited, call it while nothing is being traced
+	void writeChromeTrace(std::ostream &out) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		//the times are in microseconds, written to the nanosecond however long the run was
+		std::ios::fmtflags flags = out.flags();
+		std::streamsize precision = out.precision();
+		out << std::fixed << std::setprecision(3);
+		out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+		bool first = true;
+		for(const std::unique_ptr<RingBuffer> &buffer: buffers)
+		{
+			out << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->id
+				<< ", \"args\": {\"name\": \"thread " << buffer->id << "\"}}";
+			first = false;
+			//the oldest span is the one that will be overwritten next once the buffer has wrapped around
+			size_t oldest = buffer->numSpans < buffer->spans.size() ? 0 : buffer->next;
+			for(size_t i = 0; i < buffer->numSpans; ++i)
+			{
+				const Span &span = buffer->spans[(oldest+i) % buffer->spans.size()];
+				out << ",\n{\"name\": \"" << span.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->id
+					<< ", \"ts\": " << span.begin/1000.0 << ", \"dur\": " << (span.end-span.begin)/1000.0 << "}";
+			}
+		}
+		out << "\n]}" << std::endl;
+		out.flags(flags);
+		out.precision(precision);
+	}
+
+	bool writeChromeTrace(const std::string &path) const
+	{
+		std::ofstream file(path);
+		if(!file)
+		{
+			std::cout << "ERROR: could not create trace file \'" << path << "\'" << std::endl;
+			return false;
+		}
+		writeChromeTrace(file);
+		return true;
+	}
+
+	private:
+	struct RingBuffer
+	{
+		uint32_t id;
+		std::vector<Span> spans;
+		size_t next;
+		size_t numSpans;
+		void add(const Span &span)
+		{
+			spans[next] = span;
+			next = next+1==spans.size() ? 0 : next+1;
+			numSpans = std::min(numSpans+1,spans.size());
+		}
+	};
+
+	//a thread has a ring buffer from when it first records a span until it exits, then the buffer is free for another thread
+	struct BufferLease
+	{
+		RingBuffer *buffer;
+		BufferLease()
+		:buffer(Tracer::instance().acquireBuffer())
+		{}
+		~BufferLease()
+		{
+			Tracer::instance().releaseBuffer(buffer);
+		}
+	};
+
+	Tracer()
+	:epoch(std::chrono::steady_clock::now()),isEnabled(false),spansPerThread(1<<16)
+	{}
+
+	RingBuffer &threadBuffer()
+	{
+		thread_local BufferLease lease;
+		return *lease.buffer;
+	}
+
+	RingBuffer *acquireBuffer()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(freeBuffers.size())
+		{
+			RingBuffer *buffer = freeBuffers.back();
+			freeBuffers.pop_back();
+			return buffer;
+		}
+		buffers.emplace_back(new RingBuffer{uint32_t(buffers.size()),std::vector<Span>(spansPerThread),0,0});
+		return buffers.back().get();
+	}
+
+	void releaseBuffer(RingBuffer *buffer)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		freeBuffers.push_back(buffer);
+	}
+
+	const std::chrono::steady_clock::time_point epoch;
+	std::atomic<bool> isEnabled;
+	size_t spansPerThread;
+	mutable std::mutex mutex;
+	std::vector<std::unique_ptr<RingBuffer> > buffers;
+	std::vector<RingBuffer*> freeBuffers;
+};
+
+//records the span of time from its creation to its destruction as name, if the tracer is enabled when it is created
+//name must be a string literal
+class TraceScope
+{
+	public:
+	explicit TraceScope(const char *name)
+	:name(Tracer::instance().enabled() ? name : nullptr),begin(this->name ? Tracer::instance().now() : 0)
+	{}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+	~TraceScope()
+	{
+		if(name)
+		{
+			Tracer::instance().record(name,begin,Tracer::instance().now());
+		}
+	}
+
+	//ends the span and starts the next one as nextName, for phases that follow each other in the same scope
+	void next(const char *nextName)
+	{
+		Tracer &tracer = Tracer::instance();
+		bool wasRecording = name;
+		int64_t end = wasRecording ? tracer.now() : 0;
+		if(wasRecording)
+		{
+			tracer.record(name,begin,end);
+		}
+		name = tracer.enabled() ? nextName : nullptr;
+		begin = name ? (wasRecording ? end : tracer.now()) : 0;
+	}
+
+	private:
+	const char *name;
+	int64_t begin;
+};